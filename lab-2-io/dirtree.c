@@ -13,20 +13,35 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <assert.h>
 #include <grp.h>
 #include <pwd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 
 #define MAX_DIR 64            ///< maximum number of directories supported
+#define MAX_JOBS 256          ///< maximum number of traversal threads
+#define DENTS_BUF 32768       ///< size of the getdents64 buffer
+#define ID_CACHE 64           ///< number of entries of the user and group name caches
+#define OUT_FLUSH 65536       ///< output is written once this many bytes have accumulated
+#define KEY_CHARS 7           ///< number of name characters cached in the sort key
+#define SORT_SMALL 16         ///< ranges up to this size are insertion-sorted
+#define CACHE_MAGIC "DTCACHE1" ///< magic number of summary cache files
 
 /// @brief output control flags
 #define F_TREE      0x1       ///< enable tree view
 #define F_SUMMARY   0x2       ///< enable summary
 #define F_VERBOSE   0x4       ///< turn on verbose mode
+#define F_UNSORTED  0x8       ///< print entries in directory order while reading them
 
 /// @brief struct holding the summary
 struct summary {
@@ -40,6 +55,184 @@ struct summary {
   unsigned long long blocks;  ///< total number of blocks (512 byte blocks)
 };
 
+/// @brief directory entry as returned by getdents64 (see getdents64(2))
+struct linux_dirent64 {
+  uint64_t d_ino;             ///< inode number
+  int64_t d_off;              ///< offset to the next entry
+  unsigned short d_reclen;    ///< size of this entry
+  unsigned char d_type;       ///< file type
+  char d_name[];              ///< '\0'-terminated file name
+};
+
+/// @brief buffered reader of the entries of an open directory
+struct dirstream {
+  int fd;                     ///< open directory
+  long len;                   ///< number of valid bytes in buf
+  long pos;                   ///< offset of the next entry in buf
+  char *buf;                  ///< getdents64 buffer of DENTS_BUF bytes
+};
+
+/// @brief compact directory entry. The name is stored in the name pool of the arena.
+struct entry {
+  uint64_t key;               ///< sort key: directories first, then the first KEY_CHARS
+                              ///< characters of the name
+  uint64_t ino;               ///< inode number
+  uint32_t name;              ///< offset of the '\0'-terminated name in the name pool
+  unsigned char type;         ///< file type (DT_*)
+};
+
+/// @brief per-thread storage of the entries of the directories being processed. The entries of
+///        a directory are appended on top of those of its parent and dropped again when the
+///        directory is done, i.e., the arena is used like a stack. Since the arrays may move
+///        when they grow, entries are referred to by index.
+struct arena {
+  struct entry *ent;          ///< entries
+  struct meta *meta;          ///< metadata of the entries (verbose mode), parallel to ent
+  size_t nent;                ///< number of entries in use
+  size_t capent;              ///< capacity of ent
+  size_t capmeta;             ///< capacity of meta
+  char *names;                ///< name pool
+  size_t nnames;              ///< bytes in use in names
+  size_t capnames;            ///< capacity of names
+};
+
+/// @brief output buffer. In sequential mode, the output is written to fd whenever OUT_FLUSH
+///        bytes have accumulated; in parallel mode (fd < 0), it is kept in memory.
+struct outbuf {
+  int fd;                     ///< file descriptor to write to, or -1
+  char *buf;                  ///< buffered output
+  size_t len;                 ///< number of bytes in buf
+  size_t cap;                 ///< capacity of buf
+};
+
+/// @brief metadata of a directory entry (verbose mode)
+struct meta {
+  int err;                    ///< errno if the metadata could not be retrieved, 0 otherwise
+  unsigned int uid, gid;      ///< owner
+  unsigned long long size;    ///< size (in bytes)
+  unsigned long long blocks;  ///< number of 512 byte blocks
+};
+
+/// @brief user or group name cache entry
+struct idname {
+  int valid;                  ///< entry in use
+  unsigned int id;            ///< user or group id
+  char name[64];              ///< user or group name
+};
+
+/// @brief header of a summary cache file (--cache). The file consists of the header, the records
+///        of all cached directories sorted by path, the entries of all records, and a string
+///        area with the paths and entry names. Offsets are relative to the start of the file,
+///        which is mapped as a whole.
+struct cache_hdr {
+  char magic[8];              ///< CACHE_MAGIC
+  uint64_t size;              ///< size of the file
+  uint64_t nrec;              ///< number of records
+  uint64_t nent;              ///< number of entries
+};
+
+/// @brief cached directory
+struct cache_rec {
+  uint64_t path;              ///< offset of the directory path
+  uint64_t dev, ino;          ///< device and inode of the directory
+  int64_t mtime_sec;          ///< modification time of the directory...
+  int64_t mtime_nsec;         ///< ...and its nanoseconds
+  uint64_t ent;               ///< index of the first entry
+  uint32_t nent;              ///< number of entries, in sorted order
+  uint32_t hasmeta;           ///< the entries include their metadata (verbose mode)
+};
+
+/// @brief cached directory entry
+struct cache_ent {
+  uint64_t name;              ///< offset of the name
+  uint64_t ino;               ///< inode number
+  uint64_t size;              ///< size (in bytes)
+  uint64_t blocks;            ///< number of 512 byte blocks
+  uint32_t uid, gid;          ///< owner
+  int32_t err;                ///< errno if the metadata could not be retrieved, 0 otherwise
+  uint8_t type;               ///< file type (DT_*)
+  uint8_t pad[3];             ///< unused
+};
+
+/// @brief directory record of the next version of the cache. Either read in this run, with
+///        entries whose name offsets point into names, or carried over from the mapped cache.
+struct crec {
+  char *path;                 ///< directory path
+  int old;                    ///< carried over from the mapped cache
+  uint64_t dev, ino;          ///< device and inode of the directory
+  int64_t mtime_sec;          ///< modification time of the directory...
+  int64_t mtime_nsec;         ///< ...and its nanoseconds
+  uint32_t nent;              ///< number of entries
+  uint32_t hasmeta;           ///< the entries include their metadata
+  struct cache_ent *ent;      ///< entries (new records)
+  char *names;                ///< names of the entries (new records)
+  size_t nnames;              ///< size of names
+  const struct cache_ent *oldent; ///< entries in the mapped cache (old records)
+  size_t strpos;              ///< offset of the entry names in the string area while saving
+};
+
+/// @brief summary cache of the current run
+struct summary_cache {
+  const char *fn;             ///< file name, NULL if the cache is off
+  time_t started;             ///< start of the run
+  const char *map;            ///< mapped cache file, or NULL
+  size_t size;                ///< size of map
+  const struct cache_rec *rec; ///< records of map
+  size_t nrec;                ///< number of records
+  const struct cache_ent *ent; ///< entries of map
+  size_t nent;                ///< number of entries
+  pthread_mutex_t lock;       ///< protects newrec
+  struct crec *newrec;        ///< directories read in this run
+  size_t nnew;                ///< number of records in newrec
+  size_t capnew;              ///< capacity of newrec
+};
+
+/// @brief a directory processed by the thread pool in parallel mode (-j). The output of the
+///        directory is assembled in memory; the output of subdirectory child[k] belongs at offset
+///        pos[k] of out. The trees of jobs are stitched together once the traversal is done.
+struct job {
+  char *dn;                   ///< path of the directory
+  char *pstr;                 ///< prefix string of its entries
+  struct summary stats;       ///< statistics of this directory only (not its subdirectories)
+  struct outbuf out;          ///< output of this directory
+  struct job **child;         ///< jobs of the subdirectories, in output order
+  size_t *pos;                ///< offsets in out where the children's output goes
+  unsigned int nchild;        ///< number of children
+  unsigned int capchild;      ///< capacity of child and pos
+};
+
+/// @brief double-ended job queue of a worker thread. The owner pushes and pops at the tail
+///        (depth-first), idle workers steal from the head (where the largest subtrees are).
+struct deque {
+  pthread_mutex_t lock;       ///< protects the queue
+  struct job **job;           ///< queued jobs in [head, tail)
+  unsigned int head, tail;    ///< first and one past the last queued job
+  unsigned int cap;           ///< capacity of job
+};
+
+/// @brief work-stealing thread pool of the parallel mode
+struct pool {
+  struct deque dq[MAX_JOBS];  ///< job queues of the workers
+  unsigned int nworkers;      ///< number of workers
+  unsigned int pending;       ///< jobs queued or running (updated atomically)
+  unsigned int flags;         ///< output control flags (F_*)
+  unsigned long gen;          ///< incremented (under lock) whenever a job has been queued
+  pthread_mutex_t lock;       ///< protects gen, serializes idle workers waiting for work
+  pthread_cond_t work;        ///< signalled when new work has been queued or all work is done
+};
+
+static struct pool pool;                                ///< thread pool of the parallel mode
+static __thread unsigned int worker_id;                 ///< index of the calling worker
+static pthread_mutex_t pwlock = PTHREAD_MUTEX_INITIALIZER; ///< protects the name caches
+static struct idname ucache[ID_CACHE];                  ///< user names, direct-mapped by uid
+static struct idname gcache[ID_CACHE];                  ///< group names, direct-mapped by gid
+static __thread char dents[DENTS_BUF] __attribute__((aligned(8))); ///< getdents64 buffer
+static __thread struct arena arena;                     ///< entries of the calling thread
+static struct summary_cache cache;                      ///< summary cache (--cache)
+
+void processDir(const char *dn, const char *pstr, struct summary *stats, unsigned int flags,
+                struct outbuf *out, struct job *job);
+
 
 /// @brief abort the program with EXIT_FAILURE and an optional error message
 ///
@@ -51,46 +244,963 @@ void panic(const char *msg)
 }
 
 
-/// @brief read next directory entry from open directory 'dir'. Ignores '.' and '..' entries
+/// @brief read next directory entry from directory stream 'ds'. Entries are read in bulk with
+///        getdents64. Ignores '.' and '..' entries
 ///
-/// @param dir open DIR* stream
+/// @param ds directory stream
 /// @retval entry on success
 /// @retval NULL on error or if there are no more entries
-struct dirent *getNext(DIR *dir)
+struct linux_dirent64 *getNext(struct dirstream *ds)
 {
-  struct dirent *next;
+  struct linux_dirent64 *next;
   int ignore;
 
   do {
-    errno = 0;
-    next = readdir(dir);
-    if (errno != 0) perror(NULL);
-    ignore = next && ((strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0));
-  } while (next && ignore);
+    if (ds->pos >= ds->len) {
+      ds->len = syscall(SYS_getdents64, ds->fd, ds->buf, DENTS_BUF);
+      ds->pos = 0;
+      if (ds->len < 0) perror(NULL);
+      if (ds->len <= 0) return NULL;
+    }
+    next = (struct linux_dirent64*)(ds->buf + ds->pos);
+    ds->pos += next->d_reclen;
+    ignore = (strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0);
+  } while (ignore);
 
   return next;
 }
 
-/// @brief qsort comparator to sort directory entries. Sorted by name, directories first.
+/// @brief look up the name of user or group @a id. Names are cached; ids without a name are
+///        printed as numbers.
+///
+/// @param group look up a group (1) or a user (0)
+/// @param id user or group id
+/// @param name buffer receiving the name
+/// @param size size of @a name
+void idName(int group, unsigned int id, char *name, size_t size)
+{
+  struct idname *e = group ? &gcache[id % ID_CACHE] : &ucache[id % ID_CACHE];
+
+  pthread_mutex_lock(&pwlock);
+  if (!e->valid || (e->id != id)) {
+    const char *n = NULL;
+
+    if (group) {
+      struct group *grg = getgrgid(id);
+      if (grg != NULL) n = grg->gr_name;
+    } else {
+      struct passwd *pwu = getpwuid(id);
+      if (pwu != NULL) n = pwu->pw_name;
+    }
+
+    if (n != NULL) snprintf(e->name, sizeof(e->name), "%s", n);
+    else snprintf(e->name, sizeof(e->name), "%u", id);
+    e->id = id;
+    e->valid = 1;
+  }
+  snprintf(name, size, "%s", e->name);
+  pthread_mutex_unlock(&pwlock);
+}
+
+/// @brief compute the sort key of an entry. The most significant byte is 0 for directories
+///        and 1 otherwise, followed by the first KEY_CHARS characters of the name, zero-padded.
+///        Comparing keys as integers thus orders entries like strcmp(), directories first,
+///        unless the names share the first KEY_CHARS characters.
+///
+/// @param name entry name
+/// @param type file type (DT_*)
+/// @retval sort key
+static uint64_t entry_key(const char *name, unsigned char type)
+{
+  uint64_t key = (type != DT_DIR);
+  int end = 0;
+
+  for (int k = 0; k < KEY_CHARS; k++) {
+    if (!end && (name[k] == '\0')) end = 1;
+    key = (key << 8) | (end ? 0 : (unsigned char)name[k]);
+  }
+
+  return key;
+}
+
+/// @brief ordering of directory entries. Sorted by name, directories first.
 ///
 /// @param a pointer to first entry
 /// @param b pointer to second entry
-/// @retval -1 if a<b
-/// @retval 0  if a==b
-/// @retval 1  if a>b
-static int dirent_compare(const void *a, const void *b)
+/// @param names name pool of the entries
+/// @retval 1 if a<b
+/// @retval 0 otherwise
+static inline int entry_less(const struct entry *a, const struct entry *b, const char *names)
+{
+  // the key decides unless the names share their first characters
+  if (a->key != b->key) return a->key < b->key;
+  return strcmp(names + a->name, names + b->name) < 0;
+}
+
+/// @brief sort @a n directory entries. Quicksort (median of three) on the cached keys with
+///        insertion sort for small ranges; recursion only into the smaller part.
+///
+/// @param e entries
+/// @param n number of entries
+/// @param names name pool of the entries
+void sortEntries(struct entry *e, size_t n, const char *names)
+{
+  struct entry t;
+
+  while (n > SORT_SMALL) {
+    size_t mid = n/2;
+    ptrdiff_t i = -1, j = n;
+
+    if (entry_less(&e[mid], &e[0], names)) { t = e[0]; e[0] = e[mid]; e[mid] = t; }
+    if (entry_less(&e[n-1], &e[0], names)) { t = e[0]; e[0] = e[n-1]; e[n-1] = t; }
+    if (entry_less(&e[n-1], &e[mid], names)) { t = e[mid]; e[mid] = e[n-1]; e[n-1] = t; }
+
+    struct entry pivot = e[mid];
+    while (1) {
+      do i++; while (entry_less(&e[i], &pivot, names));
+      do j--; while (entry_less(&pivot, &e[j], names));
+      if (i >= j) break;
+      t = e[i]; e[i] = e[j]; e[j] = t;
+    }
+
+    // [0, j] and [j+1, n)
+    if ((size_t)j + 1 < n - j - 1) {
+      sortEntries(e, j + 1, names);
+      e += j + 1;
+      n -= j + 1;
+    } else {
+      sortEntries(e + j + 1, n - j - 1, names);
+      n = j + 1;
+    }
+  }
+
+  for (size_t i = 1; i < n; i++) {
+    size_t k = i;
+
+    t = e[i];
+    while ((k > 0) && entry_less(&t, &e[k-1], names)) {
+      e[k] = e[k-1];
+      k--;
+    }
+    e[k] = t;
+  }
+}
+
+/// @brief append directory entry @a d to the arena @a a. The arrays grow geometrically.
+///
+/// @param a arena
+/// @param name entry name
+/// @param type file type (DT_*)
+/// @param ino inode number
+/// @param verbose also make room for the entry's metadata
+void arenaAdd(struct arena *a, const char *name, unsigned char type, uint64_t ino, int verbose)
+{
+  size_t len = strlen(name) + 1;
+
+  if (a->nent == a->capent) {
+    a->capent = a->capent ? 2*a->capent : 256;
+    if ((a->ent = realloc(a->ent, a->capent*sizeof(struct entry))) == NULL) panic("Out of memory.");
+  }
+  if (verbose && (a->capmeta < a->capent)) {
+    a->capmeta = a->capent;
+    if ((a->meta = realloc(a->meta, a->capmeta*sizeof(struct meta))) == NULL) {
+      panic("Out of memory.");
+    }
+  }
+  if (a->nnames + len > a->capnames) {
+    while (a->nnames + len > a->capnames) a->capnames = a->capnames ? 2*a->capnames : 16384;
+    if ((a->names = realloc(a->names, a->capnames)) == NULL) panic("Out of memory.");
+  }
+
+  a->ent[a->nent].key = entry_key(name, type);
+  a->ent[a->nent].ino = ino;
+  a->ent[a->nent].type = type;
+  a->ent[a->nent].name = a->nnames;
+  memcpy(a->names + a->nnames, name, len);
+  a->nnames += len;
+  a->nent++;
+}
+
+/// @brief free the storage of arena @a a
+///
+/// @param a arena
+void arenaFree(struct arena *a)
+{
+  free(a->ent);
+  free(a->meta);
+  free(a->names);
+  memset(a, 0, sizeof(*a));
+}
+
+/// @brief make room for @a n more bytes in output buffer @a ob
+///
+/// @param ob output buffer
+/// @param n number of bytes
+void outReserve(struct outbuf *ob, size_t n)
+{
+  if (ob->len + n <= ob->cap) return;
+
+  while (ob->len + n > ob->cap) ob->cap = ob->cap ? 2*ob->cap : 2*OUT_FLUSH;
+  if ((ob->buf = realloc(ob->buf, ob->cap)) == NULL) panic("Out of memory.");
+}
+
+/// @brief write the contents of output buffer @a ob to its file descriptor
+///
+/// @param ob output buffer
+void outFlush(struct outbuf *ob)
+{
+  size_t pos = 0;
+
+  while ((ob->fd >= 0) && (pos < ob->len)) {
+    ssize_t r = write(ob->fd, ob->buf + pos, ob->len - pos);
+    if ((r < 0) && (errno == EINTR)) continue;
+    if (r <= 0) {
+      perror("write");
+      break;
+    }
+    pos += r;
+  }
+  if (ob->fd >= 0) ob->len = 0;
+}
+
+/// @brief append @a len bytes from @a s to output buffer @a ob
+///
+/// @param ob output buffer
+/// @param s data
+/// @param len number of bytes
+void outWrite(struct outbuf *ob, const char *s, size_t len)
+{
+  if (len == 0) return;
+
+  outReserve(ob, len);
+  memcpy(ob->buf + ob->len, s, len);
+  ob->len += len;
+}
+
+/// @brief append formatted output to output buffer @a ob
+///
+/// @param ob output buffer
+/// @param fmt printf format string followed by its parameters
+void outPrintf(struct outbuf *ob, const char *fmt, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(ob->buf + ob->len, ob->cap - ob->len, fmt, ap);
+  va_end(ap);
+
+  if ((len >= 0) && ((size_t)len >= ob->cap - ob->len)) {
+    outReserve(ob, len + 1);
+    va_start(ap, fmt);
+    len = vsnprintf(ob->buf + ob->len, ob->cap - ob->len, fmt, ap);
+    va_end(ap);
+  }
+  if (len > 0) ob->len += len;
+}
+
+/// @brief end the current line of output buffer @a ob and write the buffer if it is full enough
+///
+/// @param ob output buffer
+void outEndLine(struct outbuf *ob)
+{
+  outWrite(ob, "\n", 1);
+  if ((ob->fd >= 0) && (ob->len >= OUT_FLUSH)) outFlush(ob);
+}
+
+/// @brief add the counters of @a src to @a dst
+///
+/// @param dst pointer to accumulated statistics
+/// @param src pointer to statistics to add
+void addSummary(struct summary *dst, const struct summary *src)
+{
+  dst->dirs   += src->dirs;
+  dst->files  += src->files;
+  dst->links  += src->links;
+  dst->fifos  += src->fifos;
+  dst->socks  += src->socks;
+  dst->size   += src->size;
+  dst->blocks += src->blocks;
+}
+
+/// @brief queue @a job at the tail of deque @a dq
+///
+/// @param dq deque
+/// @param job job
+void dequePush(struct deque *dq, struct job *job)
+{
+  pthread_mutex_lock(&dq->lock);
+  if (dq->tail == dq->cap) {
+    if (dq->head > 0) {
+      memmove(dq->job, dq->job + dq->head, (dq->tail - dq->head)*sizeof(struct job*));
+      dq->tail -= dq->head;
+      dq->head = 0;
+    } else {
+      dq->cap = dq->cap ? 2*dq->cap : 64;
+      dq->job = realloc(dq->job, dq->cap*sizeof(struct job*));
+      if (dq->job == NULL) panic("Out of memory.");
+    }
+  }
+  dq->job[dq->tail++] = job;
+  pthread_mutex_unlock(&dq->lock);
+}
+
+/// @brief take a job from deque @a dq
+///
+/// @param dq deque
+/// @param steal take the oldest job (1) or the newest one (0)
+/// @retval job on success
+/// @retval NULL if @a dq is empty
+struct job *dequeTake(struct deque *dq, int steal)
+{
+  struct job *job = NULL;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->head < dq->tail) job = steal ? dq->job[dq->head++] : dq->job[--dq->tail];
+  if (dq->head == dq->tail) dq->head = dq->tail = 0;
+  pthread_mutex_unlock(&dq->lock);
+
+  return job;
+}
+
+/// @brief add subdirectory @a dn to the output of @a parent at the current position of @a out
+///        and queue it on the deque of the calling worker
+///
+/// @param parent job of the directory containing @a dn
+/// @param dn path of the subdirectory. Ownership passes to the new job.
+/// @param pstr prefix string of the subdirectory's entries. Ownership passes to the new job.
+/// @param out output buffer of @a parent
+void spawnDir(struct job *parent, char *dn, char *pstr, struct outbuf *out)
 {
-  struct dirent *e1 = (struct dirent*)a;
-  struct dirent *e2 = (struct dirent*)b;
+  struct job *job = calloc(1, sizeof(struct job));
+  if (job == NULL) panic("Out of memory.");
+
+  if (parent->nchild == parent->capchild) {
+    parent->capchild = parent->capchild ? 2*parent->capchild : 8;
+    parent->child = realloc(parent->child, parent->capchild*sizeof(struct job*));
+    parent->pos = realloc(parent->pos, parent->capchild*sizeof(size_t));
+    if ((parent->child == NULL) || (parent->pos == NULL)) panic("Out of memory.");
+  }
+
+  job->dn = dn;
+  job->pstr = pstr;
+  parent->child[parent->nchild] = job;
+  parent->pos[parent->nchild++] = out->len;
+
+  __atomic_add_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST);
+  dequePush(&pool.dq[worker_id], job);
+
+  pthread_mutex_lock(&pool.lock);
+  __atomic_store_n(&pool.gen, pool.gen + 1, __ATOMIC_SEQ_CST);
+  pthread_cond_signal(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief worker thread of the parallel mode. Processes jobs from its own deque and steals from
+///        the other workers when it runs dry. Returns once no job is queued or running.
+///
+/// @param arg index of the worker, passed by value as (void*)(intptr_t)
+void *worker(void *arg)
+{
+  worker_id = (unsigned int)(intptr_t)arg;
+
+  while (1) {
+    // a job queued after this point bumps gen, so the wait below cannot miss it
+    unsigned long gen = __atomic_load_n(&pool.gen, __ATOMIC_SEQ_CST);
+    struct job *job = dequeTake(&pool.dq[worker_id], 0);
 
-  // if one of the entries is a directory, it comes first
-  if (e1->d_type != e2->d_type) {
-    if (e1->d_type == DT_DIR) return -1;
-    if (e2->d_type == DT_DIR) return 1;
+    for (unsigned int k = 1; (job == NULL) && (k < pool.nworkers); k++) {
+      job = dequeTake(&pool.dq[(worker_id + k) % pool.nworkers], 1);
+    }
+
+    if (job != NULL) {
+      job->out.fd = -1;
+      processDir(job->dn, job->pstr, &job->stats, pool.flags, &job->out, job);
+
+      if (__atomic_sub_fetch(&pool.pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_broadcast(&pool.work);
+        pthread_mutex_unlock(&pool.lock);
+      }
+      continue;
+    }
+
+    // nothing to steal: done, or wait until new work has been queued since the scan started
+    pthread_mutex_lock(&pool.lock);
+    while ((pool.gen == gen) && (__atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) > 0)) {
+      pthread_cond_wait(&pool.work, &pool.lock);
+    }
+    int done = __atomic_load_n(&pool.pending, __ATOMIC_SEQ_CST) == 0;
+    pthread_mutex_unlock(&pool.lock);
+
+    if (done) break;
   }
 
-  // otherwise sorty by name
-  return strcmp(e1->d_name, e2->d_name);
+  arenaFree(&arena);
+  return NULL;
+}
+
+/// @brief print the output of @a job and its subdirectories in order, merge their statistics
+///        into @a stats, and free the jobs
+///
+/// @param job root of a tree of finished jobs
+/// @param stats pointer to statistics
+/// @param ob output buffer
+void stitch(struct job *job, struct summary *stats, struct outbuf *ob)
+{
+  size_t pos = 0;
+
+  for (unsigned int k = 0; k < job->nchild; k++) {
+    outWrite(ob, job->out.buf + pos, job->pos[k] - pos);
+    pos = job->pos[k];
+    stitch(job->child[k], stats, ob);
+  }
+  outWrite(ob, job->out.buf + pos, job->out.len - pos);
+  if (ob->len >= OUT_FLUSH) outFlush(ob);
+
+  addSummary(stats, &job->stats);
+
+  free(job->out.buf);
+  free(job->child);
+  free(job->pos);
+  free(job->dn);
+  free(job->pstr);
+  free(job);
+}
+
+/// @brief process directory @a dn and print its tree using @a njobs threads
+///
+/// @param dn absolute or relative path string
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+/// @param njobs number of threads
+/// @param ob output buffer
+void processTree(const char *dn, struct summary *stats, unsigned int flags, unsigned int njobs,
+                 struct outbuf *ob)
+{
+  pthread_t tid[MAX_JOBS];
+  struct job *root = calloc(1, sizeof(struct job));
+
+  if ((root == NULL) || ((root->dn = strdup(dn)) == NULL) || ((root->pstr = strdup("")) == NULL)) {
+    panic("Out of memory.");
+  }
+
+  pool.nworkers = njobs;
+  pool.flags = flags;
+  pool.pending = 1;
+  pool.gen = 0;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.work, NULL);
+  for (unsigned int i = 0; i < njobs; i++) {
+    pthread_mutex_init(&pool.dq[i].lock, NULL);
+    pool.dq[i].head = pool.dq[i].tail = 0;
+  }
+  dequePush(&pool.dq[0], root);
+
+  for (unsigned int i = 0; i < njobs; i++) {
+    if (pthread_create(&tid[i], NULL, worker, (void*)(intptr_t)i) != 0) {
+      panic("Cannot create thread.");
+    }
+  }
+  for (unsigned int i = 0; i < njobs; i++) pthread_join(tid[i], NULL);
+
+  for (unsigned int i = 0; i < njobs; i++) pthread_mutex_destroy(&pool.dq[i].lock);
+  pthread_cond_destroy(&pool.work);
+  pthread_mutex_destroy(&pool.lock);
+
+  stitch(root, stats, ob);
+}
+
+/// @brief open the summary cache @a fn and map its index. A missing or invalid cache file is
+///        treated as empty; it is replaced by cacheSave().
+///
+/// @param fn file name of the cache
+void cacheOpen(const char *fn)
+{
+  struct stat st;
+  int fd;
+
+  memset(&cache, 0, sizeof(cache));
+  cache.fn = fn;
+  cache.started = time(NULL);
+  pthread_mutex_init(&cache.lock, NULL);
+
+  if ((fd = open(fn, O_RDONLY | O_CLOEXEC)) < 0) return;
+
+  if ((fstat(fd, &st) == 0) && ((size_t)st.st_size > sizeof(struct cache_hdr))) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map != MAP_FAILED) {
+      const struct cache_hdr *hdr = map;
+      size_t size = st.st_size;
+
+      // the string area comes last and ends with a '\0': every offset below size that passes
+      // the bounds checks on lookup points to a terminated string
+      if ((memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) == 0) && (hdr->size == size) &&
+          (hdr->nrec <= size / sizeof(struct cache_rec)) &&
+          (hdr->nent <= size / sizeof(struct cache_ent)) &&
+          (sizeof(struct cache_hdr) + hdr->nrec*sizeof(struct cache_rec) +
+           hdr->nent*sizeof(struct cache_ent) <= size) &&
+          (((const char*)map)[size - 1] == '\0')) {
+        cache.map = map;
+        cache.size = size;
+        cache.rec = (const struct cache_rec*)(hdr + 1);
+        cache.ent = (const struct cache_ent*)(cache.rec + hdr->nrec);
+        cache.nrec = hdr->nrec;
+        cache.nent = hdr->nent;
+      } else {
+        munmap(map, size);
+      }
+    }
+  }
+  close(fd);
+}
+
+/// @brief find the cached record of directory @a dn, provided it is still valid
+///
+/// @param dn directory path
+/// @param st current metadata of @a dn
+/// @param verbose the record must include the metadata of the entries
+/// @retval record on success
+/// @retval NULL if @a dn is not cached or has changed
+const struct cache_rec *cacheLookup(const char *dn, const struct stat *st, int verbose)
+{
+  size_t lo = 0, hi = cache.nrec;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo)/2;
+    const struct cache_rec *r = &cache.rec[mid];
+    int c;
+
+    if (r->path >= cache.size) return NULL;
+    if ((c = strcmp(cache.map + r->path, dn)) == 0) {
+      if ((r->dev != st->st_dev) || (r->ino != st->st_ino) ||
+          (r->mtime_sec != st->st_mtim.tv_sec) || (r->mtime_nsec != st->st_mtim.tv_nsec) ||
+          (verbose && !r->hasmeta) ||
+          (r->ent > cache.nent) || (r->nent > cache.nent - r->ent)) {
+        return NULL;
+      }
+      return r;
+    }
+    if (c < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return NULL;
+}
+
+/// @brief append the entries of cached record @a r to the arena, in their (sorted) order
+///
+/// @param r cache record
+/// @param verbose also load the metadata of the entries
+/// @retval 0 on success
+/// @retval -1 if the record is corrupt
+int cacheLoad(const struct cache_rec *r, int verbose)
+{
+  size_t base = arena.nent, nbase = arena.nnames;
+
+  for (uint32_t i = 0; i < r->nent; i++) {
+    const struct cache_ent *ce = &cache.ent[r->ent + i];
+
+    if (ce->name >= cache.size) {
+      arena.nent = base;
+      arena.nnames = nbase;
+      return -1;
+    }
+    arenaAdd(&arena, cache.map + ce->name, ce->type, ce->ino, verbose);
+    if (verbose) {
+      struct meta *m = &arena.meta[arena.nent - 1];
+      m->err = ce->err;
+      m->uid = ce->uid;
+      m->gid = ce->gid;
+      m->size = ce->size;
+      m->blocks = ce->blocks;
+    }
+  }
+
+  return 0;
+}
+
+/// @brief remember the @a n sorted entries at arena.ent[base] of directory @a dn for cacheSave().
+///        Directories modified within the last second are not cached: further changes within the
+///        same timestamp would go unnoticed.
+///
+/// @param dn directory path
+/// @param st metadata of @a dn when it was read
+/// @param base index of the first entry in the arena
+/// @param n number of entries
+/// @param verbose the arena holds the metadata of the entries
+void cacheRecord(const char *dn, const struct stat *st, size_t base, size_t n, int verbose)
+{
+  struct crec r;
+  size_t nnames = 0;
+
+  if (st->st_mtim.tv_sec >= cache.started - 1) return;
+
+  for (size_t i = 0; i < n; i++) nnames += strlen(arena.names + arena.ent[base + i].name) + 1;
+
+  memset(&r, 0, sizeof(r));
+  r.path = strdup(dn);
+  r.ent = malloc(n*sizeof(struct cache_ent) + 1);
+  r.names = malloc(nnames + 1);
+  if ((r.path == NULL) || (r.ent == NULL) || (r.names == NULL)) panic("Out of memory.");
+
+  r.dev = st->st_dev;
+  r.ino = st->st_ino;
+  r.mtime_sec = st->st_mtim.tv_sec;
+  r.mtime_nsec = st->st_mtim.tv_nsec;
+  r.hasmeta = verbose;
+  r.nent = n;
+
+  for (size_t i = 0; i < n; i++) {
+    const struct entry *e = &arena.ent[base + i];
+    const char *name = arena.names + e->name;
+    size_t len = strlen(name) + 1;
+    struct cache_ent *ce = &r.ent[i];
+
+    memset(ce, 0, sizeof(*ce));
+    ce->name = r.nnames;
+    ce->ino = e->ino;
+    ce->type = e->type;
+    if (verbose) {
+      const struct meta *m = &arena.meta[base + i];
+      ce->err = m->err;
+      ce->uid = m->uid;
+      ce->gid = m->gid;
+      ce->size = m->size;
+      ce->blocks = m->blocks;
+    }
+    memcpy(r.names + r.nnames, name, len);
+    r.nnames += len;
+  }
+
+  pthread_mutex_lock(&cache.lock);
+  if (cache.nnew == cache.capnew) {
+    cache.capnew = cache.capnew ? 2*cache.capnew : 256;
+    if ((cache.newrec = realloc(cache.newrec, cache.capnew*sizeof(struct crec))) == NULL) {
+      panic("Out of memory.");
+    }
+  }
+  cache.newrec[cache.nnew++] = r;
+  pthread_mutex_unlock(&cache.lock);
+}
+
+/// @brief qsort comparator to sort cache records by path
+static int crec_compare(const void *a, const void *b)
+{
+  return strcmp(((const struct crec*)a)->path, ((const struct crec*)b)->path);
+}
+
+/// @brief write the summary cache: the directories read in this run, plus the still mapped
+///        records of all other directories. The file is replaced atomically.
+void cacheSave(void)
+{
+  struct crec *rec = cache.newrec;
+  size_t nrec = 0, nent = 0, strpos = 0;
+  char *tmp;
+  FILE *f;
+
+  // 1. newest record of each directory read in this run
+  if (cache.nnew > 0) qsort(cache.newrec, cache.nnew, sizeof(struct crec), crec_compare);
+  for (size_t i = 0; i < cache.nnew; i++) {
+    if ((nrec > 0) && (strcmp(rec[nrec-1].path, cache.newrec[i].path) == 0)) {
+      free(rec[nrec-1].path);
+      free(rec[nrec-1].ent);
+      free(rec[nrec-1].names);
+      nrec--;
+    }
+    rec[nrec++] = cache.newrec[i];
+  }
+
+  // 2. (sorted) old records, i.e., directories that were skipped or are not under the
+  //    traversed paths. Both lists are sorted by path, so a merge would do; the write order is
+  //    established by sorting everything once more below.
+  size_t nnew = nrec;
+  for (size_t i = 0; i < cache.nrec; i++) {
+    const struct cache_rec *r = &cache.rec[i];
+    struct crec key;
+
+    if ((r->path >= cache.size) || (r->ent > cache.nent) || (r->nent > cache.nent - r->ent)) {
+      continue;
+    }
+    key.path = (char*)cache.map + r->path;
+    if ((nnew > 0) && (bsearch(&key, rec, nnew, sizeof(struct crec), crec_compare) != NULL)) {
+      continue;
+    }
+
+    if (nrec == cache.capnew) {
+      cache.capnew = cache.capnew ? 2*cache.capnew : 256;
+      if ((rec = realloc(rec, cache.capnew*sizeof(struct crec))) == NULL) panic("Out of memory.");
+    }
+    struct crec *c = &rec[nrec++];
+    memset(c, 0, sizeof(*c));
+    c->path = key.path;
+    c->old = 1;
+    c->dev = r->dev;
+    c->ino = r->ino;
+    c->mtime_sec = r->mtime_sec;
+    c->mtime_nsec = r->mtime_nsec;
+    c->hasmeta = r->hasmeta;
+    c->nent = r->nent;
+    c->oldent = &cache.ent[r->ent];
+  }
+  cache.newrec = rec;
+  if (nrec > 0) qsort(rec, nrec, sizeof(struct crec), crec_compare);
+
+  // 3. layout: header, records, entries, strings (paths and names)
+  for (size_t i = 0; i < nrec; i++) nent += rec[i].nent;
+  size_t stroff = sizeof(struct cache_hdr) + nrec*sizeof(struct cache_rec) +
+                  nent*sizeof(struct cache_ent);
+
+  if ((asprintf(&tmp, "%s.tmp", cache.fn) < 0) || ((f = fopen(tmp, "w")) == NULL)) {
+    perror("Cannot write cache");
+    return;
+  }
+
+  struct cache_hdr hdr = { .nrec = nrec, .nent = nent };
+  memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+  fwrite(&hdr, sizeof(hdr), 1, f);
+
+  // records; a record's path is followed by the names of its entries in the string area
+  nent = 0;
+  for (size_t i = 0; i < nrec; i++) {
+    struct cache_rec r = {
+      .path = stroff + strpos, .dev = rec[i].dev, .ino = rec[i].ino,
+      .mtime_sec = rec[i].mtime_sec, .mtime_nsec = rec[i].mtime_nsec,
+      .ent = nent, .nent = rec[i].nent, .hasmeta = rec[i].hasmeta,
+    };
+    fwrite(&r, sizeof(r), 1, f);
+
+    strpos += strlen(rec[i].path) + 1;
+    rec[i].strpos = strpos;
+    if (rec[i].old) {
+      for (uint32_t k = 0; k < rec[i].nent; k++) {
+        const char *name = rec[i].oldent[k].name < cache.size ? cache.map + rec[i].oldent[k].name
+                                                              : "";
+        strpos += strlen(name) + 1;
+      }
+    } else {
+      strpos += rec[i].nnames;
+    }
+    nent += rec[i].nent;
+  }
+
+  // entries
+  for (size_t i = 0; i < nrec; i++) {
+    size_t pos = rec[i].strpos;
+
+    for (uint32_t k = 0; k < rec[i].nent; k++) {
+      struct cache_ent ce;
+
+      if (rec[i].old) {
+        ce = rec[i].oldent[k];
+        const char *name = ce.name < cache.size ? cache.map + ce.name : "";
+        ce.name = stroff + pos;
+        pos += strlen(name) + 1;
+      } else {
+        ce = rec[i].ent[k];
+        pos = rec[i].strpos + ce.name;
+        ce.name = stroff + pos;
+      }
+      fwrite(&ce, sizeof(ce), 1, f);
+    }
+  }
+
+  // strings
+  for (size_t i = 0; i < nrec; i++) {
+    fwrite(rec[i].path, strlen(rec[i].path) + 1, 1, f);
+    if (rec[i].old) {
+      for (uint32_t k = 0; k < rec[i].nent; k++) {
+        const char *name = rec[i].oldent[k].name < cache.size ? cache.map + rec[i].oldent[k].name
+                                                              : "";
+        fwrite(name, strlen(name) + 1, 1, f);
+      }
+    } else {
+      fwrite(rec[i].names, rec[i].nnames, 1, f);
+    }
+  }
+  // terminating '\0', see cacheOpen()
+  fputc('\0', f);
+
+  // the header's size field covers the whole file
+  hdr.size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, f);
+
+  if ((fclose(f) != 0) || (rename(tmp, cache.fn) != 0)) perror("Cannot write cache");
+  free(tmp);
+
+  for (size_t i = 0; i < nrec; i++) {
+    if (rec[i].old) continue;
+    free(rec[i].path);
+    free(rec[i].ent);
+    free(rec[i].names);
+  }
+  free(rec);
+  if (cache.map != NULL) munmap((void*)cache.map, cache.size);
+  pthread_mutex_destroy(&cache.lock);
+}
+
+/// @brief retrieve the metadata of entry @a name of the open directory @a dirfd, asking only for
+///        the fields we print
+///
+/// @param dirfd open directory
+/// @param name entry name
+/// @param m metadata. Out parameter.
+void statEntry(int dirfd, const char *name, struct meta *m)
+{
+  struct statx stx;
+
+  if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW,
+            STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_UID | STATX_GID, &stx) == -1) {
+    m->err = errno;
+    return;
+  }
+  m->err = 0;
+  m->uid = stx.stx_uid;
+  m->gid = stx.stx_gid;
+  m->size = stx.stx_size;
+  m->blocks = stx.stx_blocks;
+}
+
+/// @brief print entry @a name of directory @a dn and descend into it if it is a directory
+///
+/// @param dn path of the directory containing the entry
+/// @param pstr prefix string printed in front of the entry
+/// @param name entry name
+/// @param type file type (DT_*)
+/// @param m metadata of the entry (verbose mode)
+/// @param last the entry is the last one of the directory
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+/// @param out output buffer
+/// @param job in parallel mode, job of @a dn. NULL otherwise.
+void printEntry(const char *dn, const char *pstr, const char *name, unsigned char type,
+                const struct meta *m, int last, struct summary *stats, unsigned int flags,
+                struct outbuf *out, struct job *job)
+{
+  char *path = NULL;
+  int aspret; ///<variable to store a retval of asprintf. it does nothing but is set to avoid warning messages.
+
+  //
+  //print prefix and name directly into the output buffer
+  //
+  size_t start = out->len;
+  outWrite(out, pstr, strlen(pstr));
+  outWrite(out, flags & F_TREE? last? "`-" : "|-" : "  ", 2);
+  outWrite(out, name, strlen(name));
+
+  if (flags & F_VERBOSE){
+    char user[64], group[64];
+
+    if (out->len - start > 54) {
+      out->len = start + 51;
+      outWrite(out, "...  ", 5);
+    } else {
+      size_t pad = 54 - (out->len - start) + 2;
+      outReserve(out, pad);
+      memset(out->buf + out->len, ' ', pad);
+      out->len += pad;
+    }
+
+    //
+    //Handling errors that could occur when retrieving the meta data of a file
+    //Print the error message inplace of the file's meta data.
+    //
+    if (m->err != 0){
+      switch(m->err){
+        case (EACCES): outPrintf(out, "Search permission is denied"); break;
+        case (EFAULT): outPrintf(out, "Bad address"); break;
+        case (ELOOP) : outPrintf(out, "Toom many symbolic links encountere"); break;
+        case (ENAMETOOLONG): outPrintf(out, "pathname is too long"); break;
+        case (ENOENT) : outPrintf(out, "A component of pathname does not exist"); break;
+        case (ENOTDIR) : outPrintf(out, "A component of the prefix of pathname is not a directory"); break;
+        case (ENOMEM): outPrintf(out, "Out of Memory"); break;
+        case (EOVERFLOW) : outPrintf(out, "pathname refers to a file whose structural member cannot be represented"); break;
+      }
+      outEndLine(out);
+      return;
+    }
+
+    //
+    //print the files' meta data
+    //
+    idName(0, m->uid, user, sizeof(user));
+    idName(1, m->gid, group, sizeof(group));
+    outPrintf(out, "%8s:%-8s  %10d  %8d  %c", user, group, (int)m->size, (int)m->blocks,
+                          type == DT_REG? ' ':
+                          type == DT_DIR? 'd':
+                          type == DT_LNK? 'l':
+                          type == DT_CHR? 'c':
+                          type == DT_FIFO? 'f':
+                          type == DT_SOCK? 's':
+                          type == DT_BLK? 'b':
+                          '\0');
+    stats->size += (int)m->size;
+    stats->blocks += (int)m->blocks;
+  }
+  outEndLine(out);
+
+  switch (type){
+  case (DT_DIR):    stats->dirs++; 
+                    char *prefix;
+                    aspret = asprintf(&path, "%s%c%s", dn, '/', name);
+                    aspret= asprintf(&prefix, "%s%s", pstr, flags& F_TREE? last? "  " :  "| " : "  "); 
+                    if (job != NULL) {
+                      spawnDir(job, path, prefix, out); ///<queue sub-directory, output is stitched later
+                      path = NULL;
+                    } else {
+                      processDir(path, prefix, stats, flags, out, NULL); ///<access sub-directory recursively to make a tree
+                      free(prefix);
+                    }
+                    break;
+  case (DT_FIFO):    stats->fifos++;
+                     break;
+  case(DT_REG):    stats->files++;
+                   break;
+  case(DT_LNK):    stats->links++;
+                   break;
+  case(DT_SOCK):    stats->socks++;
+                    break;
+  }
+  free(path);
+  aspret = aspret;
+}
+
+/// @brief print the entries of the open directory @a ds in the order they are read (--unsorted).
+///        Only the previous entry is held back, to find out which one is the last. The
+///        directory stays open while its subdirectories are processed.
+///
+/// @param ds open directory stream of @a dn with its own buffer
+/// @param dn absolute or relative path string
+/// @param pstr prefix string printed in front of each entry
+/// @param stats pointer to statistics
+/// @param flags output control flags (F_*)
+/// @param out output buffer
+/// @param job in parallel mode, job of @a dn. NULL otherwise.
+void streamDir(struct dirstream *ds, const char *dn, const char *pstr, struct summary *stats,
+               unsigned int flags, struct outbuf *out, struct job *job)
+{
+  struct linux_dirent64 *dir;
+  struct meta m = { .err = 0 };
+  char name[256];
+  unsigned char type = DT_UNKNOWN;
+  int have = 0;
+
+  while ((dir = getNext(ds)) != NULL) {
+    if (have) {
+      if (flags & F_VERBOSE) statEntry(ds->fd, name, &m);
+      printEntry(dn, pstr, name, type, &m, 0, stats, flags, out, job);
+    }
+    snprintf(name, sizeof(name), "%s", dir->d_name);
+    type = dir->d_type;
+    have = 1;
+  }
+
+  if (have) {
+    if (flags & F_VERBOSE) statEntry(ds->fd, name, &m);
+    printEntry(dn, pstr, name, type, &m, 1, stats, flags, out, job);
+  }
 }
 
 /// @brief recursively process directory @a dn and print its tree
@@ -99,133 +1209,106 @@ static int dirent_compare(const void *a, const void *b)
 /// @param pstr prefix string printed in front of each entry
 /// @param stats pointer to statistics
 /// @param flags output control flags (F_*)
-void processDir(const char *dn, const char *pstr, struct summary *stats, unsigned int flags)
+/// @param out output buffer
+/// @param job in parallel mode, job of @a dn; subdirectories are queued instead of traversed.
+///        NULL otherwise.
+void processDir(const char *dn, const char *pstr, struct summary *stats, unsigned int flags,
+                struct outbuf *out, struct job *job)
 {
-  DIR* od = opendir(dn);
-  struct dirent *dir;
-  struct dirent *arr = NULL; ///<an array to store all directories
+  struct dirstream ds = { .fd = -1, .buf = dents };
+  struct linux_dirent64 *dir;
+  size_t base = arena.nent; ///<our entries are arena.ent[base..base+n)
+  size_t nbase = arena.nnames; ///<and their names start here in the name pool
   unsigned int n = 0; ///<# of dir entries
-  int aspret; ///<variable to store a retval of asprintf. it does nothing but is set to avoid warning messages.
+  struct stat st; ///<metadata of dn for the summary cache
+  int cached = 0; ///<entries come from the summary cache
+  int record = 0; ///<record the entries in the summary cache
+
+  //
+  //with the summary cache, the entries of an unchanged directory are taken from the cache; its
+  //subdirectories are still checked one by one
+  //
+  if ((cache.fn != NULL) && !(flags & F_UNSORTED) && (stat(dn, &st) == 0)) {
+    const struct cache_rec *r = cacheLookup(dn, &st, flags & F_VERBOSE);
+
+    cached = (r != NULL) && (cacheLoad(r, flags & F_VERBOSE) == 0);
+    record = !cached;
+  }
+  if (!cached) ds.fd = open(dn, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
   //
   //Handling errors that could occur when processing a directory.
   //Print them inplace of the entries of that directory.
   //
-  if (od == NULL) {
-    char *errp;
-    aspret = asprintf(&errp, "%s%s", pstr, flags & F_TREE? "`-" : "  ");
-    aspret = aspret; ///does nothing but is set to avoid warning messages.
-    printf("%s", errp);
+  if (!cached && (ds.fd < 0)) {
+    outWrite(out, pstr, strlen(pstr));
+    outWrite(out, flags & F_TREE? "`-" : "  ", 2);
     switch (errno){
-        case(EACCES): printf("Permission denied"); break;
-        case(EMFILE): printf("The per-process limit on the number of open file descriptors has been reached."); break;
-        case(ENFILE): printf("The system-wide limit on the total number of open files has been reached."); break;
-        case(ENOENT): printf("Directory does not exist, or name is an empty string."); break;
-        case(ENOMEM): printf("Insufficient memory to complete the operation."); break;
+        case(EACCES): outPrintf(out, "Permission denied"); break;
+        case(EMFILE): outPrintf(out, "The per-process limit on the number of open file descriptors has been reached."); break;
+        case(ENFILE): outPrintf(out, "The system-wide limit on the total number of open files has been reached."); break;
+        case(ENOENT): outPrintf(out, "Directory does not exist, or name is an empty string."); break;
+        case(ENOMEM): outPrintf(out, "Insufficient memory to complete the operation."); break;
     }
-    printf("\n");
-    free(errp);
+    outEndLine(out);
     return;
   }
-  
+
   //
-  //read every dir entry and store in arr
-  //for we don't know the maximum number of a directory, it will be reallocated continuously;
+  //unsorted mode: print while reading. Subdirectories are processed while the directory is
+  //still being read, so it needs its own getdents64 buffer
   //
-  while ((dir = getNext(od))!= NULL){
-    struct dirent *tmp = (struct dirent *)realloc(arr, (n+1)*sizeof(struct dirent));
-    
-    if (tmp != NULL) {
-        arr = tmp;
-        arr[n++] = *dir;
-    }
+  if (flags & F_UNSORTED) {
+    if ((ds.buf = malloc(DENTS_BUF)) == NULL) panic("Out of memory.");
+    streamDir(&ds, dn, pstr, stats, flags, out, job);
+    free(ds.buf);
+    close(ds.fd);
+    return;
   }
-  closedir(od);
+  
+  if (!cached) {
+    //
+    //read every dir entry and append it to the arena
+    //
+    while ((dir = getNext(&ds))!= NULL){
+      arenaAdd(&arena, dir->d_name, dir->d_type, dir->d_ino, flags & F_VERBOSE);
+    }
+    n = arena.nent - base;
 
-  qsort(arr, n, sizeof(struct dirent), dirent_compare); ///<the list of dir should be sorted
+    sortEntries(arena.ent + base, n, arena.names); ///<the list of dir should be sorted
+
+    //
+    //in verbose mode, retrieve the metadata of all entries relative to the open directory.
+    //The directory is closed before we descend into subdirectories.
+    //
+    if (flags & F_VERBOSE) {
+      for (int i = 0; i < n; i++) {
+        statEntry(ds.fd, arena.names + arena.ent[base + i].name, &arena.meta[base + i]);
+      }
+    }
+    close(ds.fd);
+
+    if (record) cacheRecord(dn, &st, base, n, flags & F_VERBOSE);
+  }
+  n = arena.nent - base;
 
   //
   //traverse dir tree and print every required information.
+  //entries are re-read from the arena in every iteration: it may have moved in the recursion
   //
   for (int i = 0; i <n ;i++){
-      char *pathWithPrefix;
-      char *path;
-      aspret = asprintf(&pathWithPrefix, "%s%s%s", 
-                        pstr, flags & F_TREE? i == n - 1? 
-                        "`-" : "|-" : "  ", arr[i].d_name);
-
-      aspret = asprintf(&path, "%s%c%s", dn, '/', arr[i].d_name);
-
-      if (flags & F_VERBOSE){
-        if (strlen(pathWithPrefix) > 54) {
-         printf("%.51s...  ", pathWithPrefix);
-        }
-        else printf("%-54s  ", pathWithPrefix);
-        
-        struct stat statbuf;
-        struct passwd *pwu;
-        struct group *grg;
-
-        //
-        //Handling errors that could occur when retrieving the meta data of a file
-        //Print the error message inplace of the file's meta data.
-        //
-        if (lstat(path, &statbuf) == -1){
-          switch(errno){
-            case (EACCES): printf("Search permission is denied\n"); break;
-            case (EFAULT): printf("Bad address\n"); break;
-            case (ELOOP) : printf("Toom many symbolic links encountere\n"); break;
-            case (ENAMETOOLONG): printf("pathname is too long\n"); break;
-            case (ENOENT) : printf("A component of pathname does not exist\n"); break;
-            case (ENOTDIR) : printf("A component of the prefix of pathname is not a directory\n"); break;
-            case (ENOMEM): printf("Out of Memory\n"); break;
-            case (EOVERFLOW) : printf("pathname refers to a file whose structural member cannot be represented\n"); break;
-          }
-          continue;
-        }
-
-        //
-        //print the files' meta data
-        //
-        printf("%8s:%-8s  ", (pwu = getpwuid(statbuf.st_uid))->pw_name, (grg = getgrgid(statbuf.st_gid))->gr_name);
-        printf("%10d  %8d  %c",(int)statbuf.st_size, (int)statbuf.st_blocks,
-                              arr[i].d_type == DT_REG? ' ':
-                              arr[i].d_type == DT_DIR? 'd':
-                              arr[i].d_type == DT_LNK? 'l':
-                              arr[i].d_type == DT_CHR? 'c':
-                              arr[i].d_type == DT_FIFO? 'f':
-                              arr[i].d_type == DT_SOCK? 's':
-                              arr[i].d_type == DT_BLK? 'b':
-                              '\0');
-        stats->size += (int)statbuf.st_size;
-        stats->blocks += (int)statbuf.st_blocks;
-      }
-      else printf("%s", pathWithPrefix);
-      printf("\n");
-
-      free(pathWithPrefix);
+    const struct entry *e = &arena.ent[base + i];
 
-      switch (arr[i].d_type){
-      case (DT_DIR):    stats->dirs++; 
-                        char *prefix;
-                        aspret= asprintf(&prefix, "%s%s", pstr, flags& F_TREE? i == n-1? "  " :  "| " : "  "); 
-                        processDir(path, prefix, stats, flags); ///<access sub-directory recursively to make a tree
-                        free(prefix);
-                        break;
-      case (DT_FIFO):    stats->fifos++;
-                         break;
-      case(DT_REG):    stats->files++;
-                       break;
-      case(DT_LNK):    stats->links++;
-                       break;
-      case(DT_SOCK):    stats->socks++;
-                        break;
-    }
-      free(path);
-      aspret = aspret;
+    printEntry(dn, pstr, arena.names + e->name, e->type,
+               (flags & F_VERBOSE) ? &arena.meta[base + i] : NULL, i == n - 1,
+               stats, flags, out, job);
   }
 
-  free(arr);
+  //
+  //drop our entries from the arena
+  //
+  arena.nent = base;
+  arena.nnames = nbase;
 }
 
 
@@ -248,7 +1331,7 @@ void syntax(const char *argv0, const char *error, ...)
 
   assert(argv0 != NULL);
 
-  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-h] [path...]\n"
+  fprintf(stderr, "Usage %s [-t] [-s] [-v] [-j N] [--unsorted] [--cache FILE] [-h] [path...]\n"
                   "Gather information about directory trees. If no path is given, the current directory\n"
                   "is analyzed.\n"
                   "\n"
@@ -256,9 +1339,13 @@ void syntax(const char *argv0, const char *error, ...)
                   " -t        print the directory tree (default if no other option specified)\n"
                   " -s        print summary of directories (total number of files, total file size, etc)\n"
                   " -v        print detailed information for each file. Turns on tree view.\n"
+                  " -j N      traverse subdirectories in parallel with N threads (max %d)\n"
+                  " --unsorted  print entries in directory order as they are read\n"
+                  " --cache FILE  keep directory listings in FILE and reuse those of unchanged\n"
+                  "           directories in later runs\n"
                   " -h        print this help\n"
                   " path...   list of space-separated paths (max %d). Default is the current directory.\n",
-                  basename(argv0), MAX_DIR);
+                  basename(argv0), MAX_JOBS, MAX_DIR);
 
   exit(EXIT_FAILURE);
 }
@@ -276,6 +1363,9 @@ int main(int argc, char *argv[])
 
   struct summary tstat, dstat;
   unsigned int flags = 0;
+  unsigned int njobs = 1;
+  const char *cachefn = NULL;
+  struct outbuf ob = { .fd = STDOUT_FILENO };
 
   //
   // parse arguments
@@ -286,6 +1376,17 @@ int main(int argc, char *argv[])
       if      (!strcmp(argv[i], "-t")) flags |= F_TREE;
       else if (!strcmp(argv[i], "-s")) flags |= F_SUMMARY;
       else if (!strcmp(argv[i], "-v")) flags |= F_VERBOSE;
+      else if (!strcmp(argv[i], "--unsorted")) flags |= F_UNSORTED;
+      else if (!strcmp(argv[i], "--cache")) {
+        if (i+1 >= argc) syntax(argv[0], "Missing cache file.");
+        cachefn = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-j")) {
+        char *end;
+        long n = (i+1 < argc) ? strtol(argv[++i], &end, 10) : 0;
+        if ((n < 1) || (n > MAX_JOBS) || (*end != '\0')) syntax(argv[0], "Invalid number of threads.");
+        njobs = n;
+      }
       else if (!strcmp(argv[i], "-h")) syntax(argv[0], NULL);
       else syntax(argv[0], "Unrecognized option '%s'.", argv[i]);
     } else {
@@ -307,6 +1408,8 @@ int main(int argc, char *argv[])
   //
   // TODO
 
+  if (cachefn != NULL) cacheOpen(cachefn);
+
   //set total stat to 0
   memset(&tstat, 0, sizeof(struct summary));
 
@@ -325,7 +1428,14 @@ int main(int argc, char *argv[])
     }
   
     printf("%s\n", directories[i]);
-    processDir(directories[i], "",  &dstat, flags);
+    //the summary cache is keyed by absolute path
+    char *dn = (cachefn != NULL) ? realpath(directories[i], NULL) : NULL;
+
+    fflush(stdout);
+    if (njobs > 1) processTree(dn ? dn : directories[i], &dstat, flags, njobs, &ob);
+    else processDir(dn ? dn : directories[i], "",  &dstat, flags, &ob, NULL);
+    outFlush(&ob);
+    free(dn);
 
     //
     //Print Footer
@@ -351,13 +1461,7 @@ int main(int argc, char *argv[])
     //
     //Add every member of dstat to total stat
     //
-    tstat.blocks += dstat.blocks;
-    tstat.dirs += dstat.dirs;
-    tstat.fifos += dstat.fifos;
-    tstat.links += dstat.links;
-    tstat.size += dstat.size;
-    tstat.socks += dstat.socks;
-    tstat.files += dstat.files; 
+    addSummary(&tstat, &dstat);
   }
   
 
@@ -380,6 +1484,9 @@ int main(int argc, char *argv[])
     }
 
   }
+  free(ob.buf);
+  if (cachefn != NULL) cacheSave();
+
   //
   // that's all, folks
   //
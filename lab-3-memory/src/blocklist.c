@@ -34,19 +34,153 @@
 #include <assert.h>
 #include "blocklist.h"
 
+// The blocks are kept in a treap (randomized balanced binary search tree) ordered by ptr. Each
+// tree node embeds the Block structure as its first member and records the size of its subtree,
+// so that lookups by ptr and by index are O(log n). In addition, the blocks remain threaded in
+// a doubly-linked list between the head and tail sentinels (Block.prev/next) in ascending ptr
+// order; iteration thus remains a simple list walk.
+//
+// Blocks with identical ptr values are permitted; a new block is inserted after all existing
+// blocks with the same ptr, and find_block()/delete_block() operate on the first one.
+//
+// Tree nodes are allocated from a pool of NODE_CHUNK nodes at a time; deleted nodes are kept in
+// a free list and recycled.
+
+/// @brief treap node
+typedef struct __node {
+  Block           b;              ///< block data. Must be the first member
+  struct __node   *left, *right;  ///< left and right child
+  unsigned int    prio;           ///< random heap priority
+  size_t          count;          ///< number of nodes in subtree
+} Node;
+
+#define NODE_CHUNK 1024           ///< number of nodes allocated at once
+
+/// @brief chunk of nodes in the node pool
+typedef struct __chunk {
+  struct __chunk  *next;          ///< next chunk
+  Node            node[NODE_CHUNK]; ///< nodes
+} Chunk;
+
 Block *head = NULL;
 Block *tail = NULL;
 
+static Block sentinel[2];         ///< head & tail sentinels
+static Node  *root = NULL;        ///< root of treap
+static Chunk *chunks = NULL;      ///< allocated node chunks
+static Node  *free_nodes = NULL;  ///< free list of recycled nodes (linked by right)
+static size_t chunk_used = NODE_CHUNK; ///< used nodes in first chunk
+static unsigned int seed = 2463534242u; ///< xorshift PRNG state
+
+/// @brief xorshift pseudo-random number generator for treap priorities
+static unsigned int rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+/// @brief number of nodes in subtree @a t
+static size_t count(Node *t)
+{
+  return t != NULL ? t->count : 0;
+}
+
+/// @brief recompute subtree size of @a t
+static Node* update(Node *t)
+{
+  t->count = count(t->left) + count(t->right) + 1;
+  return t;
+}
+
+/// @brief get a zeroed node from the pool
+/// @retval Node* new node
+/// @retval NULL on failure
+static Node* alloc_node(void)
+{
+  Node *n = free_nodes;
+
+  if (n != NULL) {
+    free_nodes = n->right;
+  } else {
+    if (chunk_used == NODE_CHUNK) {
+      Chunk *c = malloc(sizeof(Chunk));
+      if (c == NULL) return NULL;
+
+      c->next = chunks;
+      chunks = c;
+      chunk_used = 0;
+    }
+    n = &chunks->node[chunk_used++];
+  }
+
+  *n = (Node){ .count = 1 };
+  return n;
+}
+
+/// @brief return node @a n to the pool
+static void free_node(Node *n)
+{
+  n->right = free_nodes;
+  free_nodes = n;
+}
+
+/// @brief split treap @a t into nodes with ptr < @a ptr (@a l) and ptr >= @a ptr (@a r). If
+///        @a incl is set, nodes with ptr == @a ptr are put into @a l instead.
+static void split(Node *t, void *ptr, int incl, Node **l, Node **r)
+{
+  if (t == NULL) {
+    *l = *r = NULL;
+  } else if ((t->b.ptr < ptr) || (incl && (t->b.ptr == ptr))) {
+    split(t->right, ptr, incl, &t->right, r);
+    *l = update(t);
+  } else {
+    split(t->left, ptr, incl, l, &t->left);
+    *r = update(t);
+  }
+}
+
+/// @brief merge treaps @a l and @a r. All nodes in @a l must precede those in @a r.
+static Node* merge(Node *l, Node *r)
+{
+  if (l == NULL) return r;
+  if (r == NULL) return l;
+
+  if (l->prio > r->prio) {
+    l->right = merge(l->right, r);
+    return update(l);
+  } else {
+    r->left = merge(l, r->left);
+    return update(r);
+  }
+}
+
+/// @brief remove the leftmost node from treap @a t
+/// @param[out] n removed node
+/// @retval Node* remaining treap
+static Node* remove_first(Node *t, Node **n)
+{
+  if (t->left == NULL) {
+    *n = t;
+    return t->right;
+  }
+
+  t->left = remove_first(t->left, n);
+  return update(t);
+}
+
 void init_blocklist(void)
 {
   if (head != NULL) free_blocklist();
 
   //
-  // create head & tail sentinels
+  // set up head & tail sentinels
   //
-  head = calloc(1, sizeof(Block));
-  tail = calloc(1, sizeof(Block));
+  head = &sentinel[0];
+  tail = &sentinel[1];
 
+  *head = *tail = (Block){ 0 };
   head->next = tail;
   tail->prev = head;
 
@@ -63,12 +197,14 @@ void init_blocklist(void)
 
 void free_blocklist(void)
 {
-  Block *b = head;
-  while (b != NULL) {
-    Block *next = b->next;
-    free(b);
-    b = next;
+  while (chunks != NULL) {
+    Chunk *next = chunks->next;
+    free(chunks);
+    chunks = next;
   }
+  chunk_used = NODE_CHUNK;
+  free_nodes = NULL;
+  root = NULL;
   head = tail = NULL;
 }
 
@@ -77,22 +213,31 @@ Block* insert_block(void *ptr, size_t size, int flags)
   assert(head != NULL);
   assert((ptr != NULL) && (ptr != (void*)-1));
 
-  Block *b = calloc(1, sizeof(Block));
-  if (b != NULL) {
+  Node *n = alloc_node();
+  if (n != NULL) {
+    Block *b = &n->b;
     b->ptr = ptr;
     b->size = size;
     b->flags = flags;
+    n->prio = rnd();
+
+    // split into blocks <= ptr and blocks > ptr; n goes in between
+    Node *l, *r;
+    split(root, ptr, 1, &l, &r);
 
-    Block *s = head;
-    while (s->ptr <= ptr) s = s->next;
+    Node *s = r;
+    while ((s != NULL) && (s->left != NULL)) s = s->left;
+    Block *succ = s != NULL ? &s->b : tail;
 
-    b->next = s;
-    b->prev = s->prev;
-    s->prev = b;
+    b->next = succ;
+    b->prev = succ->prev;
+    succ->prev = b;
     b->prev->next = b;
+
+    root = merge(merge(l, n), r);
   }
 
-  return b;
+  return n != NULL ? &n->b : NULL;
 }
 
 Block* find_block(void *ptr)
@@ -100,23 +245,37 @@ Block* find_block(void *ptr)
   assert(head != NULL);
   assert((ptr != NULL) && (ptr != (void*)-1));
 
-  Block *b = head;
-  while (b->ptr < ptr) b = b->next;
+  Node *t = root, *res = NULL;
+  while (t != NULL) {
+    if (t->b.ptr < ptr) {
+      t = t->right;
+    } else {
+      if (t->b.ptr == ptr) res = t;
+      t = t->left;
+    }
+  }
 
-  return b->ptr == ptr ? b : NULL;
+  return res != NULL ? &res->b : NULL;
 }
 
 Block* find_block_by_index(size_t idx)
 {
   assert(head != NULL);
 
-  Block *b = head->next;
-  while ((b != tail) && (idx > 0)) {
-    b = b->next;
-    idx--;
+  Node *t = root;
+  while (t != NULL) {
+    size_t lc = count(t->left);
+    if (idx < lc) {
+      t = t->left;
+    } else if (idx > lc) {
+      idx -= lc + 1;
+      t = t->right;
+    } else {
+      break;
+    }
   }
 
-  return b != tail ? b : NULL;
+  return t != NULL ? &t->b : NULL;
 }
 
 int delete_block(void *ptr)
@@ -124,14 +283,24 @@ int delete_block(void *ptr)
   assert(head != NULL);
   assert((ptr != NULL) && (ptr != (void*)-1));
 
-  Block *b = find_block(ptr);
-  if (b != NULL) {
-    b->prev->next = b->next;
-    b->next->prev = b->prev;
-    free(b);
+  // split into blocks < ptr and blocks >= ptr; the first node of the latter is the candidate
+  Node *l, *r, *n = NULL;
+  split(root, ptr, 0, &l, &r);
+
+  if (r != NULL) {
+    Node *f = r;
+    while (f->left != NULL) f = f->left;
+    if (f->b.ptr == ptr) r = remove_first(r, &n);
+  }
+
+  if (n != NULL) {
+    n->b.prev->next = n->b.next;
+    n->b.next->prev = n->b.prev;
+    free_node(n);
   }
+  root = merge(l, r);
 
-  return b != NULL;
+  return n != NULL;
 }
 
 const Block* first_block(void)
@@ -170,15 +339,7 @@ size_t num_blocks(void)
 {
   assert(head != NULL);
 
-  size_t res = 0;
-  Block *b = head->next;
-
-  while (b != tail) {
-    b = b->next;
-    res++;
-  }
-
-  return res;
+  return count(root);
 }
 
 Block** get_block_array(void)
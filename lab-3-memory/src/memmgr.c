@@ -22,6 +22,9 @@
 // - minimal block size: 32 bytes (header +footer + 2 data words)
 // - h,f: header/footer of free block
 // - H,F: header/footer of allocated block
+// - allocated blocks have no footer. Bit 1 of every header (PREV_ALLOC) records whether the
+//   preceding block is allocated, so a footer is only read (and only exists) when that bit says
+//   the preceding block is free. A 32-byte block carries up to 24 bytes of payload.
 //
 // - state after initialization
 //
@@ -31,25 +34,87 @@
 //               |   |   |                                         |       |
 //               v   v   v                                         v       v
 //               +---+---+-----------------------------------------+---+---+
-//               |???| F | h :                                 : f | H |???|
+//               |???| H | h :                                 : f | H |???|
 //               +---+---+-----------------------------------------+---+---+
 //                       ^                                         ^
 //                       |                                         |
 //               32-byte aligned                           32-byte aligned
 //
-// - allocation policies: first, next, best fit
+// - allocation policies: first, next, best fit, segregated fit
 // - block splitting: always at 32-byte boundaries
 // - immediate coalescing upon free
+// - heap extension: a free block at the end of the heap is reused; only the shortfall is requested
+//   (rounded up to a page), and the unused part of the new space goes back to the free pool
+// - heap trimming: once the free block at the end of the heap exceeds TRIM_THRESHOLD, mm_free()
+//   releases all but CHUNKSIZE bytes of it with a negative ds_sbrk()
+// - foreign brk movements: if another module (e.g., the slab allocator) has moved the brk since the
+//   last extension, the memory in between is covered by an allocated fence block
+//
+// Segregated explicit free lists:
+// -------------------------------
+// In addition to the implicit list formed by the boundary tags, every free block is linked into
+// one of NUM_CLASSES doubly-linked free lists. The links are stored in the first two payload
+// words of the free block, which is why the minimal block size of 32 bytes suffices.
+//
+//   free block:  +---+------+------+-- ... --+---+
+//                | h | pred | succ |         | f |
+//                +---+------+------+-- ... --+---+
+//                    ^
+//                    bp
+//
+// - size classes: one class each for 32, 64, 96, and 128 bytes, then power-of-two ranges
+//   (129-256, 257-512, ...); the last class holds all larger blocks
+// - blocks are inserted at the head of their class list (LIFO)
+// - the lists are kept up to date for all policies; only the segregated fit policy
+//   (ap_Segregated) uses them to search, and thus only ever touches free blocks
+//
+// Thread-safe mode:
+// -----------------
+// mm_setthreadsafe(1) lets several threads share the heap. All heap state is then protected by
+// heap_lock, but small blocks (32, 64, 96, and 128 bytes) are recycled through per-thread caches
+// that are accessed without locking:
+//
+// - each thread owns TC_BINS singly-linked bins of cached blocks, linked through the first payload
+//   word; cached blocks keep their ALLOC tags, so to the heap they look allocated
+// - mm_malloc pops from the bin of the block size; an empty bin is refilled with TC_FILL blocks
+//   under a single acquisition of heap_lock
+// - mm_free pushes onto the bin; a full bin returns TC_FILL blocks to the heap in one batch
+// - bins are flushed back to the heap when a thread exits; mm_init invalidates all caches
+//
+// Huge blocks:
+// ------------
+// Requests whose block size exceeds mmap_threshold bypass the heap. They are served from a private
+// anonymous mapping of their own, outside the data segment, and unmapped again by mm_free. This
+// keeps large, short-lived buffers from fragmenting the heap or pinning the brk.
+//
+//   mapping:  +---+------------------------------------ ... ----+
+//             | H | payload                                     |
+//             +---+------------------------------------ ... ----+
+//             ^   ^
+//             |   bp
+//             page-aligned
+//
+// - the header holds the length of the mapping (a multiple of the page size) and the MAPPED flag
+// - mm_realloc resizes huge blocks with mremap; a huge block shrinking below the threshold moves
+//   back into the heap
+// - fresh mappings are zero-filled, so mm_calloc does not clear huge blocks
+// - huge blocks never touch heap state and need no locking in thread-safe mode
+// - the threshold defaults to MMAP_THRESHOLD; mm_init() takes it from the environment variable
+//   MM_MMAP_THRESHOLD if set, mm_setmmapthreshold() changes it at runtime. 0 disables huge blocks
+//   (necessary for mm_driver's validation, which only accepts blocks inside the data segment)
 //
 
 
+#define _GNU_SOURCE                                    // for mremap()
 #include <assert.h>
 #include <error.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "dataseg.h"
@@ -68,21 +133,32 @@ static void *(*get_free_block)(size_t) = NULL;         ///< get free block for s
 static int  mm_initialized = 0;                        ///< initialized flag (yes: 1, otherwise 0)
 static int  mm_loglevel    = 0;                        ///< log level (0: off; 1: info; 2: verbose)
 static void *nf_ptr		   = NULL;					   ///< a pointer to save the lately searched address, for next-fit allocation policy
+static int  mm_threadsafe  = 0;                        ///< thread-safe mode (0: off, 1: on)
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the heap in thread-safe mode
+static unsigned long heap_epoch = 0;                   ///< incremented by mm_init(); invalidates thread caches
+static MemStats stats;                                 ///< allocator statistics
+static size_t nsearched    = 0;                        ///< blocks examined by the current free block search
+static size_t mmap_threshold = 0;                      ///< block size above which blocks are mapped (0: never)
 /// @}
 
 /// @name Macro definitions
 /// @{
 #define MAX(a, b)          ((a) > (b) ? (a) : (b))     ///< MAX function
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))     ///< MIN function
 
 #define TYPE               unsigned long               ///< word type of heap
 #define TYPE_SIZE          sizeof(TYPE)                ///< size of word type
 
 #define ALLOC              1                           ///< block allocated flag
 #define FREE               0                           ///< block free flag
+#define PREV_ALLOC         2                           ///< preceding block allocated flag (header only)
+#define MAPPED             4                           ///< huge block in its own mapping flag (header only)
 #define STATUS_MASK        ((TYPE)(0x7))               ///< mask to retrieve flagsfrom header/footer
 #define SIZE_MASK          (~STATUS_MASK)              ///< mask to retrieve size from header/footer
 
-#define CHUNKSIZE          (1*(1 << 12))               ///< size by which heap is extended
+#define CHUNKSIZE          (1*(1 << 12))               ///< initial heap size and trim padding
+#define TRIM_THRESHOLD     (32*CHUNKSIZE)              ///< trailing free space that triggers trimming
+#define MMAP_THRESHOLD     (16*CHUNKSIZE)              ///< default block size above which blocks are mapped
 
 #define BS                 32                          ///< minimal block size. Must be a power of 2
 #define BS_MASK            (~(BS-1))                   ///< alignment mask
@@ -99,19 +175,45 @@ static void *nf_ptr		   = NULL;					   ///< a pointer to save the lately searche
 #define GET(p)             (*(TYPE*)(p))               ///< read word at *p
 #define GET_SIZE(p)        (SIZE(GET(p)))              ///< extract size from header/footer
 #define GET_STATUS(p)      (STATUS(GET(p)))            ///< extract status from header/footer
+#define GET_ALLOC(p)       (GET(p) & ALLOC)            ///< extract allocated flag from header/footer
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)       ///< extract preceding block allocated flag from header
+#define GET_MAPPED(p)      (GET(p) & MAPPED)           ///< extract huge block flag from header
+#define IS_HUGE(asize)     (mmap_threshold && ((asize) > mmap_threshold)) ///< block of asize bytes is mapped
 
 // TODO add more macros as needed
 #define NEXT_PTR(p)		   ((p)+TYPE_SIZE)			   ///< get pointer to word following p
 
 #define NEXT_BLKP(p)	   ((p) + GET_SIZE(HDRP(p)))   ///< address of next block
-#define PREV_BLKP(p)	   ((p) - GET_SIZE(PREV_PTR(HDRP(p)))) ///< address of prev block
+#define PREV_BLKP(p)	   ((p) - GET_SIZE(PREV_PTR(HDRP(p)))) ///< address of prev block (only if it is free)
 
 #define PUT(p, val)		   (*(TYPE*)(p) = (val))	   ///< write word at *p
+#define SET_PREV_ALLOC(p)  PUT(p, GET(p) | PREV_ALLOC) ///< set preceding block allocated flag in header
+#define CLR_PREV_ALLOC(p)  PUT(p, GET(p) & ~PREV_ALLOC) ///< clear preceding block allocated flag in header
+
+#define ASIZE(size)        (((size) + TYPE_SIZE + BS-1) / BS * BS) ///< block size for payload of size bytes
 
 #define HEAP_SIZE	   	   (heap_end - heap_start)	   ///< the size of heap	   
 
 #define HDRP(bp)		   (PREV_PTR(bp))			   ///< find address of the header, given block pointer bp						
-#define FTRP(bp)		   (PREV_PTR(HDRP(bp) + GET_SIZE(HDRP(bp)))) ///< find address of the footer, given block pointer bp
+#define FTRP(bp)		   (PREV_PTR(HDRP(bp) + GET_SIZE(HDRP(bp)))) ///< find address of the footer, given (free) block pointer bp
+
+#define PRED_FREE(bp)      (*(void**)(bp))             ///< predecessor of free block bp in its free list
+#define SUCC_FREE(bp)      (*(void**)NEXT_PTR(bp))     ///< successor of free block bp in its free list
+
+#define TC_NEXT(bp)        (*(void**)(bp))             ///< next block of cached block bp in its bin
+#define TC_KEY(bp)         (*(void**)NEXT_PTR(bp))     ///< owner cache of cached block bp
+
+#define NUM_CLASSES        16                          ///< number of segregated free list size classes
+#define SMALL_CLASSES      4                           ///< number of exact-size classes (BS..4*BS)
+
+#define TC_BINS            SMALL_CLASSES               ///< number of thread cache bins (one per small class)
+#define TC_MAX             32                          ///< maximum number of blocks per thread cache bin
+#define TC_FILL            16                          ///< blocks moved per thread cache refill/flush
+
+#define STAT(f, n)         (stats.f += (n))            ///< count event f (heap_lock held, if needed)
+#define STAT_CALL(f)       STAT_ATOMIC(f, 1)           ///< count API call f; callers may race
+#define STAT_ATOMIC(f, n)  (mm_threadsafe ? __atomic_add_fetch(&stats.f, (n), __ATOMIC_RELAXED) \
+                                          : (stats.f += (n))) ///< count event f without heap_lock
 
 
 /// @brief print a log message if level <= mm_loglevel. The variadic argument is a printf format
@@ -172,9 +274,70 @@ static void mm_panic(const char *func, ...)
 /// @}
 
 
+/// @name segregated free lists
+/// @{
+static void *free_lists[NUM_CLASSES];                  ///< heads of the segregated free lists
+
+/// @brief compute the size class of a block
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval int index into free_lists
+static int size_class(size_t size)
+{
+  if (size <= SMALL_CLASSES*BS) return size/BS - 1;
+
+  int c = SMALL_CLASSES;
+  size_t limit = 2*SMALL_CLASSES*BS;
+  while ((c < NUM_CLASSES-1) && (size > limit)) {
+    limit <<= 1;
+    c++;
+  }
+
+  return c;
+}
+
+/// @brief insert free block @a bp at the head of the free list of its size class
+/// @param bp block pointer of free block
+static void insert_free_block(void *bp)
+{
+  int c = size_class(GET_SIZE(HDRP(bp)));
+
+  STAT(free_bytes, GET_SIZE(HDRP(bp)));
+  PRED_FREE(bp) = NULL;
+  SUCC_FREE(bp) = free_lists[c];
+  if (free_lists[c] != NULL) PRED_FREE(free_lists[c]) = bp;
+  free_lists[c] = bp;
+}
+
+/// @brief unlink free block @a bp from the free list of its size class. The header of @a bp must
+///        still contain the size the block was inserted with.
+/// @param bp block pointer of free block
+static void remove_free_block(void *bp)
+{
+  void *pred = PRED_FREE(bp);
+  void *succ = SUCC_FREE(bp);
+
+  stats.free_bytes -= GET_SIZE(HDRP(bp));
+  if (pred != NULL) SUCC_FREE(pred) = succ;
+  else free_lists[size_class(GET_SIZE(HDRP(bp)))] = succ;
+  if (succ != NULL) PRED_FREE(succ) = pred;
+}
+/// @}
+
+
 static void* ff_get_free_block(size_t);
 static void* nf_get_free_block(size_t);
 static void* bf_get_free_block(size_t);
+static void* sl_get_free_block(size_t);
+static void* malloc_block(size_t);
+static void* free_block(void*);
+static void* extend_heap(size_t);
+static int   trim_heap(size_t);
+static void* resize_block(void*, size_t);
+static void* tc_malloc(size_t);
+static int   tc_free(void*);
+static void* map_block(size_t);
+static void  unmap_block(void*);
+static void* remap_block(void*, size_t);
 
 void mm_init(AllocationPolicy ap)
 {
@@ -188,6 +351,7 @@ void mm_init(AllocationPolicy ap)
     case ap_FirstFit: get_free_block = ff_get_free_block; apstr = "first fit"; break;
     case ap_NextFit:  get_free_block = nf_get_free_block; apstr = "next fit";  break;
     case ap_BestFit:  get_free_block = bf_get_free_block; apstr = "best fit";  break;
+    case ap_Segregated: get_free_block = sl_get_free_block; apstr = "segregated fit"; break;
     default: PANIC("Invalid allocation policy.");
   }
   LOG(2, "  allocation policy       %s\n", apstr);
@@ -212,7 +376,11 @@ void mm_init(AllocationPolicy ap)
   //
   
   // 1. make some memory
+  memset(&stats, 0, sizeof(stats));
+  const char *mt = getenv("MM_MMAP_THRESHOLD");
+  mmap_threshold = mt != NULL ? strtoul(mt, NULL, 0) : MMAP_THRESHOLD;
   ds_sbrk(CHUNKSIZE);
+  STAT(sbrk, 1);
   ds_heap_brk = ds_sbrk(0);
   if (ds_heap_brk == (void*)-1) PANIC("Cannot extend heap");
 
@@ -224,14 +392,19 @@ void mm_init(AllocationPolicy ap)
 
   //	- set initial/end sentinels 
   PUT(PREV_PTR(heap_start),	PACK(0, ALLOC));
-  PUT(heap_end, 			PACK(0, ALLOC));
+  PUT(heap_end, 			PACK(0, ALLOC));          // preceded by the free initial block
 
 
   // 3. create initial free block
   //	- set header 
-  PUT(heap_start, 			PACK(HEAP_SIZE, FREE));
+  PUT(heap_start, 			PACK(HEAP_SIZE, FREE | PREV_ALLOC));
   //	- set footer
   PUT(PREV_PTR(heap_end), 	PACK(HEAP_SIZE, FREE));
+  //	- reset policy state, invalidate thread caches, and put the block on its free list
+  nf_ptr = NULL;
+  heap_epoch++;
+  memset(free_lists, 0, sizeof(free_lists));
+  insert_free_block(NEXT_PTR(heap_start));
   //
   // heap is initialized
   //
@@ -243,49 +416,145 @@ void* mm_malloc(size_t size)
 {
   LOG(1, "mm_malloc(0x%lx)", size);
   assert(mm_initialized);
+  STAT_CALL(malloc);
 
   size_t asize; ///< adjusted block size
-  size_t xsize; ///< amount to extend heap
-  void* bp;
 
   // 1. adjust block size
   //	- if size == 0, we won't allocate
   if (size == 0) return NULL;
   //	- adjust block size to include overhead & alignment reqs
-  asize = ((size + 2 * TYPE_SIZE - 1) / BS + 1) * BS;
+  asize = ASIZE(size);
   LOG(0, "size : %d --> adjusted size: %d", size, asize);
-  
-  // 2. find a fit free block according to policy
-  //	- if there's a fit free block, split if possible. Set tags' size and their flags, and return
-  if ((bp = get_free_block(asize)) != NULL) {
-	if (GET_SIZE(HDRP(bp)) > asize) {
-		PUT(HDRP(bp) + asize, 		PACK(GET_SIZE(HDRP(bp)) - asize, FREE));
-		PUT(FTRP(bp)		,		PACK(GET_SIZE(HDRP(bp)) - asize, FREE));
-		
-		PUT(HDRP(bp)		,		PACK(asize, ALLOC));
-		PUT(FTRP(bp)		, 		PACK(asize, ALLOC));
-	}
-	else {
-		PUT(HDRP(bp)		,		PACK(asize, ALLOC));
-		PUT(FTRP(bp)		,		PACK(asize, ALLOC));
-	}
-	return bp;
+
+  // 2. huge blocks get a mapping of their own
+  if (IS_HUGE(asize)) return map_block(size);
+
+  // 3. in thread-safe mode, go through the thread cache (small blocks) or the heap lock
+  if (mm_threadsafe) return tc_malloc(asize);
+
+  return malloc_block(asize);
+}
+
+/// @brief allocate a block of @a asize bytes from the heap. In thread-safe mode, the caller must
+///        hold heap_lock.
+/// @param asize adjusted block size (including header & footer tags), in bytes
+/// @retval void* block pointer of allocated block
+static void* malloc_block(size_t asize)
+{
+  void* bp;
+
+  // 1. find a fit free block according to policy
+  //	- if we cannot find any fit free block, then get more memory. A free block at the end of the
+  //	  heap is topped up by the difference
+  nsearched = 0;
+  bp = get_free_block(asize);
+  STAT(search, 1);
+  STAT(search_hist[nsearched == 0 ? 0 : MIN(64 - __builtin_clzl(nsearched), MM_SEARCH_BUCKETS-1)], 1);
+  if (bp == NULL) {
+	if ((bp = extend_heap(asize)) == NULL) PANIC("Cannot extend heap");
   }
 
-  // 3. if we cannot find any fit free block, then get more memory and allocate.
-  //	- get more memory
-  xsize = MAX(asize, CHUNKSIZE);
-  bp = ds_sbrk(xsize);
+  // 2. split if possible. Set tags' size and their flags, and return
+  //	- the predecessor of a free block is always allocated
+  size_t csize = GET_SIZE(HDRP(bp));
+  remove_free_block(bp);
+  if (csize > asize) {
+	STAT(split, 1);
+	PUT(HDRP(bp) + asize, 		PACK(csize - asize, FREE | PREV_ALLOC));
+	PUT(FTRP(bp)		,		PACK(csize - asize, FREE));
+
+	PUT(HDRP(bp)		,		PACK(asize, ALLOC | PREV_ALLOC));
+	insert_free_block(NEXT_BLKP(bp));
+  }
+  else {
+	PUT(HDRP(bp)		,		PACK(asize, ALLOC | PREV_ALLOC));
+	SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+  }
+  return bp;
+}
+
+/// @brief extend the heap so that it ends in a free block of at least @a asize bytes. A free block
+///        at the end of the heap is topped up; the data segment grows by the shortfall rounded up
+///        to a multiple of the page size. In thread-safe mode, the caller must hold heap_lock.
+/// @param asize block size (including header & footer tags), in bytes
+/// @retval void* block pointer of the free block at the end of the heap
+/// @retval NULL if the data segment cannot be extended
+static void* extend_heap(size_t asize)
+{
+  // 1. if somebody else (e.g., the slab allocator) moved the brk, the new space is not adjacent to
+  //    the heap. The trailing free block then cannot be reused, and fencing off the foreign memory
+  //    costs up to two blocks
+  void *brk = ds_sbrk(0);
+  int contiguous = (brk == ds_heap_brk);
+  size_t avail = (contiguous && !GET_PREV_ALLOC(heap_end)) ? GET_SIZE(PREV_PTR(heap_end)) : 0;
+  size_t need = asize - avail + (contiguous ? 0 : 2*BS);
+  size_t xsize = (need + PAGESIZE - 1) / PAGESIZE * PAGESIZE;
+
+  if (ds_sbrk(xsize) == (void*)-1) return NULL;
   ds_heap_brk = ds_sbrk(0);
-  if (ds_heap_brk == (void*)-1) PANIC("Cannot extend heap");
-  
+  STAT(sbrk, 1);
+
+  // 2. the new block starts at the old end sentinel and inherits its flags. Foreign memory is
+  //    covered by an allocated fence block that starts at the old end sentinel instead
+  void *bp = NEXT_PTR(heap_end);
+  TYPE prev_alloc = GET_PREV_ALLOC(heap_end);
+  if (!contiguous) {
+	void *hdrp = (void*)(((TYPE)brk + BS-1) / BS * BS);
+	PUT(heap_end, PACK(hdrp - heap_end, ALLOC | prev_alloc));
+	bp = NEXT_PTR(hdrp);
+	prev_alloc = PREV_ALLOC;
+  }
+
   heap_end = (TYPE*)(((TYPE)ds_heap_brk -1) / BS * BS);
-  PUT(heap_end, PACK(0, ALLOC));
+  PUT(heap_end, PACK(0, ALLOC | PREV_ALLOC));
 
-  // 	- allocate
-  PUT(HDRP(bp), PACK(xsize, ALLOC));
-  PUT(FTRP(bp), PACK(xsize, ALLOC));
-  return bp;
+  // 3. free the new block; this coalesces it with the preceding block and puts it on a free list
+  PUT(HDRP(bp), PACK(heap_end - HDRP(bp), ALLOC | prev_alloc));
+
+  return free_block(bp);
+}
+
+/// @brief give the free block at the end of the heap back to the data segment, except for @a pad
+///        bytes. Memory is released in multiples of the page size. In thread-safe mode, the caller
+///        must hold heap_lock.
+/// @param pad number of bytes to keep at the end of the heap
+/// @retval 1 if memory was released
+/// @retval 0 otherwise
+static int trim_heap(size_t pad)
+{
+  // only memory at the top of the data segment can be given back
+  if ((ds_sbrk(0) != ds_heap_brk) || GET_PREV_ALLOC(heap_end)) return 0;
+
+  size_t size = GET_SIZE(PREV_PTR(heap_end));
+  if (size <= pad) return 0;
+
+  size_t release = (size - pad) / PAGESIZE * PAGESIZE;
+  if (release == 0) return 0;
+
+  // 1. shrink the free block, or drop it if nothing remains
+  void *bp = NEXT_PTR(heap_end - size);
+  TYPE prev_alloc = PREV_ALLOC;
+  remove_free_block(bp);
+  if (size > release) {
+	PUT(HDRP(bp), PACK(size - release, FREE | PREV_ALLOC));
+	PUT(FTRP(bp), PACK(size - release, FREE));
+	insert_free_block(bp);
+	prev_alloc = 0;
+  }
+
+  // 2. lower the brk and move the end sentinel
+  if (ds_sbrk(-(intptr_t)release) == (void*)-1) PANIC("Cannot shrink heap");
+  ds_heap_brk = ds_sbrk(0);
+  STAT(sbrk, 1);
+
+  heap_end = (TYPE*)(((TYPE)ds_heap_brk -1) / BS * BS);
+  PUT(heap_end, PACK(0, ALLOC | prev_alloc));
+
+  // 3. a next fit search must not resume beyond the new end of the heap
+  if (nf_ptr >= heap_end) nf_ptr = NULL;
+
+  return 1;
 }
 
 void* mm_calloc(size_t nmemb, size_t size)
@@ -293,13 +562,14 @@ void* mm_calloc(size_t nmemb, size_t size)
   LOG(1, "mm_calloc(0x%lx, 0x%lx)", nmemb, size);
 
   assert(mm_initialized);
+  STAT_CALL(calloc);
 
   //
-  // calloc is simply malloc() followed by memset()
+  // calloc is simply malloc() followed by memset(). Huge blocks are fresh zero pages
   //
   void *payload = mm_malloc(nmemb * size);
 
-  if (payload != NULL) memset(payload, 0, nmemb * size);
+  if ((payload != NULL) && !GET_MAPPED(HDRP(payload))) memset(payload, 0, nmemb * size);
 
   return payload;
 }
@@ -309,12 +579,103 @@ void* mm_realloc(void *ptr, size_t size)
   LOG(1, "mm_realloc(%p, 0x%lx)", ptr, size);
 
   assert(mm_initialized);
+  STAT_CALL(realloc);
 
-  //
-  // TODO (optional)
-  //
+  size_t asize; ///< adjusted block size
 
-  return NULL;
+  // 1. handle the degenerate cases
+  //	- realloc(NULL, size) is malloc(size), realloc(ptr, 0) is free(ptr)
+  if (ptr == NULL) return mm_malloc(size);
+  if (size == 0) {
+	mm_free(ptr);
+	return NULL;
+  }
+  if (!GET_ALLOC(HDRP(ptr))) PANIC("You're trying to reallocate a free block.");
+  //	- adjust block size to include overhead & alignment reqs
+  asize = ASIZE(size);
+
+  // 2. try to resize the block in place. Huge blocks are remapped as long as they stay huge; heap
+  //    blocks growing beyond the threshold move to a mapping
+  void *bp = NULL;
+  if (GET_MAPPED(HDRP(ptr))) {
+	if (IS_HUGE(asize)) bp = remap_block(ptr, size);
+  } else if (!IS_HUGE(asize)) {
+	if (mm_threadsafe) pthread_mutex_lock(&heap_lock);
+	bp = resize_block(ptr, asize);
+	if (mm_threadsafe) pthread_mutex_unlock(&heap_lock);
+  }
+  if (bp != NULL) return bp;
+
+  // 3. otherwise, move the payload to a new block
+  size_t psize = GET_SIZE(HDRP(ptr)) - TYPE_SIZE;
+  if ((bp = mm_malloc(size)) == NULL) return NULL;
+  memcpy(bp, ptr, MIN(psize, size));
+  mm_free(ptr);
+
+  return bp;
+}
+
+/// @brief split the allocated block @a bp after @a asize bytes and return the tail to the heap
+/// @param bp block pointer of allocated block
+/// @param asize new block size, in bytes. Must be a multiple of BS
+static void split_block(void *bp, size_t asize)
+{
+  size_t rest = GET_SIZE(HDRP(bp)) - asize;
+  if (rest == 0) return;
+
+  STAT(split, 1);
+  PUT(HDRP(bp), PACK(asize, ALLOC | GET_PREV_ALLOC(HDRP(bp))));
+
+  // the tail becomes an allocated block of its own, which free_block() merges with a free successor
+  bp = NEXT_BLKP(bp);
+  PUT(HDRP(bp), PACK(rest, ALLOC | PREV_ALLOC));
+  free_block(bp);
+}
+
+/// @brief resize the allocated block @a ptr to @a asize bytes without moving it. Shrinking splits
+///        off the tail; growing absorbs a free successor and/or extends the heap if the block (with
+///        its free successor) ends at heap_end. In thread-safe mode, the caller must hold heap_lock.
+/// @param ptr block pointer of allocated block
+/// @param asize adjusted block size (including header & footer tags), in bytes
+/// @retval void* @a ptr if the block was resized in place
+/// @retval NULL if the block cannot be resized in place
+static void* resize_block(void *ptr, size_t asize)
+{
+  size_t csize = GET_SIZE(HDRP(ptr));
+
+  // 1. shrink (or keep) in place
+  if (asize <= csize) {
+	split_block(ptr, asize);
+	return ptr;
+  }
+
+  // 2. grow into the free successor
+  void *next = NEXT_BLKP(ptr);
+  int next_free = !GET_ALLOC(HDRP(next));
+  size_t avail = csize + (next_free ? GET_SIZE(HDRP(next)) : 0);
+
+  //	- not enough: extend the heap if nothing but free space follows the block
+  if (avail < asize) {
+	void *end = next_free ? NEXT_BLKP(next) : next;
+	if ((HDRP(end) != heap_end) || (ds_sbrk(0) != ds_heap_brk)) return NULL;
+
+	if (extend_heap(asize - csize) == NULL) return NULL;
+	next_free = 1;
+	avail = csize + GET_SIZE(HDRP(next));
+  }
+
+  //	- absorb the successor; a next fit search must not resume inside the grown block
+  if (next_free) {
+	remove_free_block(next);
+	if (nf_ptr == HDRP(next)) nf_ptr = HDRP(ptr);
+  }
+  PUT(HDRP(ptr), PACK(avail, ALLOC | GET_PREV_ALLOC(HDRP(ptr))));
+  SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+
+  // 3. return what we don't need
+  split_block(ptr, asize);
+
+  return ptr;
 }
 
 void mm_free(void *ptr)
@@ -322,44 +683,72 @@ void mm_free(void *ptr)
   LOG(1, "mm_free(%p)", ptr);
 
   assert(mm_initialized);
+  STAT_CALL(free);
 
-  // 1. if ptr points freed memory block, an error is printed
-  if (!GET_STATUS(HDRP(ptr))) PANIC("You're trying to free already free block."); 
-  
-  size_t size = GET_SIZE(HDRP(ptr));
-
-  // 2. Set flags of tags FREE
-  PUT(HDRP(ptr), PACK(size, FREE));
-  PUT(FTRP(ptr), PACK(size, FREE));
+  // 1. free(NULL) does nothing; if ptr points freed memory block, an error is printed
+  if (ptr == NULL) return;
+  if (!GET_ALLOC(HDRP(ptr))) PANIC("You're trying to free already free block."); 
 
-  // 3. coalescing
-  TYPE* prev_bp = (TYPE*)PREV_BLKP(ptr);
-  TYPE* next_bp = (TYPE*)NEXT_BLKP(ptr);
-  TYPE* prev_hdr = (TYPE*)HDRP(prev_bp);
-  TYPE* next_hdr = (TYPE*)HDRP(next_bp);
+  // 2. huge blocks are simply unmapped
+  if (GET_MAPPED(HDRP(ptr))) {
+    unmap_block(ptr);
+    return;
+  }
 
+  // 3. in thread-safe mode, cache small blocks or free them under the heap lock
+  if (mm_threadsafe) {
+    if (tc_free(ptr)) return;
 
-  size_t prev_alloc = GET_STATUS(prev_hdr);
-  size_t next_alloc = GET_STATUS(next_hdr);
-  if (prev_alloc && next_alloc) {
-	  return;
+    pthread_mutex_lock(&heap_lock);
   }
-  else if (prev_alloc && !next_alloc){
-	  size += GET_SIZE(next_hdr);
-	  PUT(HDRP(ptr), PACK(size, FREE));
-	  PUT(FTRP(next_bp), PACK(size, FREE));
+
+  // 4. give memory back once the free block at the end of the heap grows too large
+  ptr = free_block(ptr);
+  if ((NEXT_BLKP(ptr) == NEXT_PTR(heap_end)) && (GET_SIZE(HDRP(ptr)) > TRIM_THRESHOLD)) {
+    trim_heap(CHUNKSIZE);
   }
-  else if (!prev_alloc && next_alloc){
-	  size += GET_SIZE(prev_hdr);
-	  PUT(prev_hdr, PACK(size, FREE));
-	  PUT(FTRP(ptr), PACK(size,FREE));
+
+  if (mm_threadsafe) pthread_mutex_unlock(&heap_lock);
+}
+
+/// @brief return the allocated block @a ptr to the heap and coalesce it with its free neighbors.
+///        In thread-safe mode, the caller must hold heap_lock.
+/// @param ptr block pointer of allocated block
+/// @retval void* block pointer of the resulting (coalesced) free block
+static void* free_block(void *ptr)
+{
+  size_t size = GET_SIZE(HDRP(ptr));
+
+  // 1. coalescing. Free neighbors are unlinked from their free lists before their tags change.
+  //	- the preceding block is only looked at (through its footer) if the prev-alloc bit says it's free
+  void* next_bp = NEXT_BLKP(ptr);
+  size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
+  size_t next_alloc = GET_ALLOC(HDRP(next_bp));
+
+  if (!next_alloc) {
+	  STAT(coalesce, 1);
+	  remove_free_block(next_bp);
+	  size += GET_SIZE(HDRP(next_bp));
   }
-  else {
-	 size += (GET_SIZE(prev_hdr) + GET_SIZE(next_hdr));
-	 PUT(prev_hdr, PACK(size, FREE));
-	 PUT(FTRP(next_bp), PACK(size, FREE));
+  if (!prev_alloc) {
+	  STAT(coalesce, 1);
+	  void* prev_bp = PREV_BLKP(ptr);
+	  remove_free_block(prev_bp);
+	  size += GET_SIZE(HDRP(prev_bp));
+	  ptr = prev_bp;
   }
 
+  // 2. Set tags of the merged block FREE. Its predecessor is allocated, its successor learns
+  //    that it follows a free block.
+  PUT(HDRP(ptr), PACK(size, FREE | PREV_ALLOC));
+  PUT(FTRP(ptr), PACK(size, FREE));
+  CLR_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+
+  // 3. a next fit search must never resume inside the merged block
+  if ((nf_ptr > HDRP(ptr)) && (nf_ptr < HDRP(ptr) + size)) nf_ptr = HDRP(ptr);
+
+  insert_free_block(ptr);
+  return ptr;
 }
 
 /// @name block allocation policites
@@ -378,8 +767,9 @@ static void* ff_get_free_block(size_t size)
   void* hdrp = heap_start;
 
   // 1. find the first fit block using header
-  while ((hdrp < heap_end) && ((size > GET_SIZE(hdrp)) || (GET_STATUS(hdrp) == ALLOC))) {
+  while ((hdrp < heap_end) && ((size > GET_SIZE(hdrp)) || GET_ALLOC(hdrp))) {
 	hdrp += GET_SIZE(hdrp);
+	nsearched++;
   }
 
   // 2. if there's fit block, return its block pointer
@@ -401,16 +791,26 @@ static void* nf_get_free_block(size_t size)
 
   // 1. if nf_ptr is NULL, set it start of the heap
   if (nf_ptr == NULL) nf_ptr = heap_start;
+  void *start = nf_ptr;
 
   // 2. search from the lately searched address to the end
-  while ((nf_ptr < heap_end) && ((size > GET_SIZE(nf_ptr)) || (GET_STATUS(nf_ptr) == ALLOC))){
+  while ((nf_ptr < heap_end) && ((size > GET_SIZE(nf_ptr)) || GET_ALLOC(nf_ptr))){
 	nf_ptr += GET_SIZE(nf_ptr);
+	nsearched++;
   }
 
   // 3. if there's a fit block found, return its block pointer
   if (nf_ptr < heap_end) return NEXT_PTR(nf_ptr);
+
+  // 4. otherwise, wrap around and search from the start of the heap up to where we began
+  nf_ptr = heap_start;
+  while ((nf_ptr < start) && ((size > GET_SIZE(nf_ptr)) || GET_ALLOC(nf_ptr))){
+	nf_ptr += GET_SIZE(nf_ptr);
+	nsearched++;
+  }
+  if (nf_ptr < start) return NEXT_PTR(nf_ptr);
   
-  // 4. otherwise, set nf_ptr NULL and return it
+  // 5. otherwise, set nf_ptr NULL and return it
   return nf_ptr = NULL;
 }
 
@@ -431,13 +831,14 @@ static void* bf_get_free_block(size_t size)
 
   // 1. search all the blocks from the start to the end, and find the best-fit block
   while (hdrp < heap_end){
-	if ((size <= GET_SIZE(hdrp)) && (GET_STATUS(hdrp) == FREE)) {
-		if (GET_SIZE(hdrp) < minSize) {
+	if ((size <= GET_SIZE(hdrp)) && !GET_ALLOC(hdrp)) {
+		if ((bf_ptr == NULL) || (GET_SIZE(hdrp) < minSize)) {
 			bf_ptr = hdrp;
 			minSize = GET_SIZE(hdrp);
 		}
 	}
 	hdrp += GET_SIZE(hdrp);
+	nsearched++;
   }
   
 
@@ -447,6 +848,241 @@ static void* bf_get_free_block(size_t size)
 
 }
 
+/// @brief find and return a free block of at least @a size bytes (segregated fit). Searches the
+///        free list of the size class of @a size first and then moves on to larger classes.
+/// @param size size of block (including header & footer tags), in bytes
+/// @retval void* pointer to header of large enough free block
+/// @retval NULL if no free block of the requested size is avilable
+static void* sl_get_free_block(size_t size)
+{
+  LOG(1, "sl_get_free_block(0x%lx (%lu))", size, size);
+
+  assert(mm_initialized);
+
+  // 1. scan the lists from the block's own class upward. Blocks in higher classes always fit,
+  //    so the scan ends at the head of the first non-empty one
+  for (int c = size_class(size); c < NUM_CLASSES; c++) {
+    void *bp = free_lists[c];
+    while ((bp != NULL) && (GET_SIZE(HDRP(bp)) < size)) {
+      bp = SUCC_FREE(bp);
+      nsearched++;
+    }
+
+    if (bp != NULL) return bp;
+  }
+
+  // 2. no free block is large enough
+  return NULL;
+}
+
+/// @}
+
+
+/// @name huge blocks
+/// @{
+
+/// @brief length of the mapping of a huge block with a payload of @a size bytes
+#define MAP_SIZE(size)     (((size) + TYPE_SIZE + PAGESIZE-1) / PAGESIZE * PAGESIZE)
+
+/// @brief allocate a huge block with a payload of @a size bytes in a mapping of its own
+/// @param size payload size, in bytes
+/// @retval void* block pointer of huge block
+/// @retval NULL if the mapping cannot be created
+static void* map_block(size_t size)
+{
+  size_t len = MAP_SIZE(size);
+
+  void *hdrp = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (hdrp == MAP_FAILED) return NULL;
+
+  PUT(hdrp, PACK(len, ALLOC | MAPPED));
+  STAT_ATOMIC(mmap, 1);
+  STAT_ATOMIC(mmap_bytes, len);
+
+  return NEXT_PTR(hdrp);
+}
+
+/// @brief unmap huge block @a bp
+/// @param bp block pointer of huge block
+static void unmap_block(void *bp)
+{
+  size_t len = GET_SIZE(HDRP(bp));
+
+  if (munmap(HDRP(bp), len) != 0) PANIC("Cannot unmap huge block");
+  STAT_ATOMIC(mmap_bytes, -len);
+}
+
+/// @brief resize huge block @a bp to a payload of @a size bytes. The block may move.
+/// @param bp block pointer of huge block
+/// @param size new payload size, in bytes
+/// @retval void* block pointer of resized huge block
+/// @retval NULL if the mapping cannot be resized
+static void* remap_block(void *bp, size_t size)
+{
+  size_t len = GET_SIZE(HDRP(bp));
+  size_t nlen = MAP_SIZE(size);
+  if (nlen == len) return bp;
+
+  void *hdrp = mremap(HDRP(bp), len, nlen, MREMAP_MAYMOVE);
+  if (hdrp == MAP_FAILED) return NULL;
+
+  PUT(hdrp, PACK(nlen, ALLOC | MAPPED));
+  STAT_ATOMIC(mmap_bytes, nlen - len);
+
+  return NEXT_PTR(hdrp);
+}
+
+/// @}
+
+
+/// @name thread caches
+/// @{
+
+/// @brief per-thread cache of small blocks
+typedef struct {
+  void *bin[TC_BINS];             ///< cached blocks of size (i+1)*BS
+  int  count[TC_BINS];            ///< number of blocks in each bin
+  unsigned long epoch;            ///< heap_epoch the cached blocks belong to
+  int  registered;                ///< exit handler registered (yes: 1, otherwise 0)
+} ThreadCache;
+
+static __thread ThreadCache tcache;                    ///< cache of the calling thread
+static pthread_key_t tc_key;                           ///< key whose destructor flushes a thread's cache
+static pthread_once_t tc_key_once = PTHREAD_ONCE_INIT; ///< creates tc_key exactly once
+
+/// @brief return all blocks of thread cache @a tc to the heap. Takes heap_lock.
+/// @param tc thread cache
+static void tc_flush(ThreadCache *tc)
+{
+  if (tc->epoch != heap_epoch) return;
+
+  pthread_mutex_lock(&heap_lock);
+  for (int b = 0; b < TC_BINS; b++) {
+    while (tc->bin[b] != NULL) {
+      void *bp = tc->bin[b];
+      tc->bin[b] = TC_NEXT(bp);
+      free_block(bp);
+    }
+    tc->count[b] = 0;
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/// @brief thread exit handler. Flushes the exiting thread's cache.
+/// @param arg thread cache of the exiting thread
+static void tc_destroy(void *arg)
+{
+  tc_flush((ThreadCache*)arg);
+}
+
+/// @brief create tc_key. Called once through pthread_once().
+static void tc_create_key(void)
+{
+  if (pthread_key_create(&tc_key, tc_destroy) != 0) PANIC("Cannot create thread cache key.");
+}
+
+/// @brief prepare the calling thread's cache for use. Drops blocks of a previous heap and
+///        registers the exit handler on first use.
+static void tc_prepare(void)
+{
+  if (tcache.epoch != heap_epoch) {
+    memset(tcache.bin, 0, sizeof(tcache.bin));
+    memset(tcache.count, 0, sizeof(tcache.count));
+    tcache.epoch = heap_epoch;
+  }
+
+  if (!tcache.registered) {
+    pthread_once(&tc_key_once, tc_create_key);
+    pthread_setspecific(tc_key, &tcache);
+    tcache.registered = 1;
+  }
+}
+
+/// @brief allocate a block of @a asize bytes in thread-safe mode. Small blocks are taken from the
+///        thread cache, which is refilled from the heap when empty.
+/// @param asize adjusted block size (including header & footer tags), in bytes
+/// @retval void* block pointer of allocated block
+static void* tc_malloc(size_t asize)
+{
+  void *bp;
+
+  // 1. large blocks always come from the heap
+  if (asize > TC_BINS*BS) {
+    pthread_mutex_lock(&heap_lock);
+    bp = malloc_block(asize);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+  }
+
+  tc_prepare();
+  int b = asize/BS - 1;
+
+  // 2. refill an empty bin by carving TC_FILL blocks out of one heap block. malloc_block() splits
+  //    off any excess, so the block holds exactly TC_FILL blocks of asize bytes.
+  if (tcache.bin[b] == NULL) {
+    pthread_mutex_lock(&heap_lock);
+    bp = malloc_block(TC_FILL*asize);
+    for (int i = 0; i < TC_FILL; i++) {
+      PUT(HDRP(bp), PACK(asize, ALLOC | (i == 0 ? GET_PREV_ALLOC(HDRP(bp)) : PREV_ALLOC)));
+      TC_NEXT(bp) = tcache.bin[b];
+      TC_KEY(bp) = &tcache;
+      tcache.bin[b] = bp;
+      bp = NEXT_BLKP(bp);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    tcache.count[b] = TC_FILL;
+  }
+
+  // 3. pop a block off the bin
+  bp = tcache.bin[b];
+  tcache.bin[b] = TC_NEXT(bp);
+  tcache.count[b]--;
+  TC_KEY(bp) = NULL;
+
+  return bp;
+}
+
+/// @brief cache the allocated block @a ptr in the thread cache. A full bin first returns TC_FILL
+///        blocks to the heap.
+/// @param ptr block pointer of allocated block
+/// @retval 1 if the block was cached
+/// @retval 0 if the block is too large to be cached
+static int tc_free(void *ptr)
+{
+  size_t size = GET_SIZE(HDRP(ptr));
+  if (size > TC_BINS*BS) return 0;
+
+  tc_prepare();
+  int b = size/BS - 1;
+
+  // 1. a block that carries our key is most likely already in the bin
+  if (TC_KEY(ptr) == &tcache) {
+    for (void *bp = tcache.bin[b]; bp != NULL; bp = TC_NEXT(bp)) {
+      if (bp == ptr) PANIC("You're trying to free already free block.");
+    }
+  }
+
+  // 2. make room in a full bin
+  if (tcache.count[b] == TC_MAX) {
+    pthread_mutex_lock(&heap_lock);
+    for (int i = 0; i < TC_FILL; i++) {
+      void *bp = tcache.bin[b];
+      tcache.bin[b] = TC_NEXT(bp);
+      free_block(bp);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    tcache.count[b] -= TC_FILL;
+  }
+
+  // 3. push the block onto the bin
+  TC_NEXT(ptr) = tcache.bin[b];
+  TC_KEY(ptr) = &tcache;
+  tcache.bin[b] = ptr;
+  tcache.count[b]++;
+
+  return 1;
+}
+
 /// @}
 
 void mm_setloglevel(int level)
@@ -454,6 +1090,57 @@ void mm_setloglevel(int level)
   mm_loglevel = level;
 }
 
+int mm_trim(size_t pad)
+{
+  LOG(1, "mm_trim(0x%lx)", pad);
+
+  assert(mm_initialized);
+
+  if (mm_threadsafe) pthread_mutex_lock(&heap_lock);
+  int res = trim_heap(pad);
+  if (mm_threadsafe) pthread_mutex_unlock(&heap_lock);
+
+  return res;
+}
+
+void mm_stats(MemStats *res)
+{
+  assert(mm_initialized);
+  assert(res != NULL);
+
+  if (mm_threadsafe) pthread_mutex_lock(&heap_lock);
+
+  // 1. copy the counters
+  *res = stats;
+  res->heap_size = HEAP_SIZE;
+  res->in_use = res->heap_size - res->free_bytes;
+
+  // 2. the largest free block is in the highest non-empty size class
+  res->largest_free = 0;
+  for (int c = NUM_CLASSES-1; (c >= 0) && (res->largest_free == 0); c--) {
+    for (void *bp = free_lists[c]; bp != NULL; bp = SUCC_FREE(bp)) {
+      res->largest_free = MAX(res->largest_free, GET_SIZE(HDRP(bp)));
+    }
+  }
+
+  if (mm_threadsafe) pthread_mutex_unlock(&heap_lock);
+
+  res->fragmentation = res->free_bytes > 0 ? 1.0 - (double)res->largest_free / res->free_bytes : 0.0;
+}
+
+void mm_setmmapthreshold(size_t threshold)
+{
+  mmap_threshold = threshold;
+}
+
+void mm_setthreadsafe(int active)
+{
+  // blocks cached by the calling thread go back to the heap when leaving thread-safe mode
+  if (mm_threadsafe && (active <= 0) && mm_initialized) tc_flush(&tcache);
+
+  mm_threadsafe = (active > 0);
+}
+
 
 void mm_check(void)
 {
@@ -464,6 +1151,7 @@ void mm_check(void)
   if (get_free_block == ff_get_free_block) apstr = "first fit";
   else if (get_free_block == nf_get_free_block) apstr = "next fit";
   else if (get_free_block == bf_get_free_block) apstr = "best fit";
+  else if (get_free_block == sl_get_free_block) apstr = "segregated fit";
   else apstr = "invalid";
 
   LOG(2, "  allocation policy    %s\n", apstr);
@@ -473,38 +1161,58 @@ void mm_check(void)
   printf("  heap_start:             %p\n", heap_start);
   printf("  heap_end:               %p\n", heap_end);
   printf("  allocation policy:      %s\n", apstr);
+  printf("  thread-safe mode:       %s\n", mm_threadsafe ? "on" : "off");
   //printf("  next_block:             %p\n", next_block);   // this will be needed for the next fit policy
 
   printf("\n");
   p = PREV_PTR(heap_start);
   printf("  initial sentinel:       %p: size: %6lx (%7ld), status: %s\n",
-         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
+         p, GET_SIZE(p), GET_SIZE(p), GET_ALLOC(p) ? "allocated" : "free");
   p = heap_end;
   printf("  end sentinel:           %p: size: %6lx (%7ld), status: %s\n",
-         p, GET_SIZE(p), GET_SIZE(p), GET_STATUS(p) == ALLOC ? "allocated" : "free");
+         p, GET_SIZE(p), GET_SIZE(p), GET_ALLOC(p) ? "allocated" : "free");
   printf("\n");
   printf("  blocks:\n");
 
   long errors = 0;
+  long nfree = 0;
+  size_t free_bytes = 0;
+  TYPE prev_status = ALLOC;
   p = heap_start;
   while (p < heap_end) {
     TYPE hdr = GET(p);
     TYPE size = SIZE(hdr);
-    TYPE status = STATUS(hdr);
+    TYPE status = hdr & ALLOC;
     printf("    %p: size: %6lx (%7ld), status: %s\n", 
            p, size, size, status == ALLOC ? "allocated" : "free");
 
-    void *fp = p + size - TYPE_SIZE;
-    TYPE ftr = GET(fp);
-    TYPE fsize = SIZE(ftr);
-    TYPE fstatus = STATUS(ftr);
-
-    if ((size != fsize) || (status != fstatus)) {
+    if (!(hdr & PREV_ALLOC) != (prev_status == FREE)) {
       errors++;
-      printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
-             fp, fsize, fstatus);
+      printf("    --> ERROR: prev-alloc bit does not match status of preceding block\n");
     }
 
+    // only free blocks have a footer
+    if (status == FREE) {
+      nfree++;
+      free_bytes += size;
+
+      void *fp = p + size - TYPE_SIZE;
+      TYPE ftr = GET(fp);
+      TYPE fsize = SIZE(ftr);
+      TYPE fstatus = STATUS(ftr);
+
+      if ((size != fsize) || (fstatus != FREE)) {
+        errors++;
+        printf("    --> ERROR: footer at %p with different properties: size: %lx, status: %lx\n", 
+               fp, fsize, fstatus);
+      }
+      if (prev_status == FREE) {
+        errors++;
+        printf("    --> ERROR: two consecutive free blocks (missed coalescing)\n");
+      }
+    }
+    prev_status = status;
+
     p = p + size;
     if (size == 0) {
       printf("    WARNING: size 0 detected, aborting traversal.\n");
@@ -512,6 +1220,44 @@ void mm_check(void)
     }
   }
 
+  if ((p == heap_end) && (!GET_PREV_ALLOC(heap_end) != (prev_status == FREE))) {
+    errors++;
+    printf("    --> ERROR: prev-alloc bit of end sentinel does not match status of last block\n");
+  }
+
+  printf("\n");
+  printf("  free lists:\n");
+
+  long nlisted = 0;
+  for (int c = 0; c < NUM_CLASSES; c++) {
+    long n = 0;
+    void *pred = NULL;
+    void *bp = free_lists[c];
+    while ((bp != NULL) && (nlisted + n <= nfree)) {
+      if ((bp <= heap_start) || (bp >= heap_end) || GET_ALLOC(HDRP(bp)) ||
+          (size_class(GET_SIZE(HDRP(bp))) != c) || (PRED_FREE(bp) != pred)) {
+        errors++;
+        printf("    --> ERROR: invalid free list entry %p in class %d\n", bp, c);
+        break;
+      }
+      pred = bp;
+      bp = SUCC_FREE(bp);
+      n++;
+    }
+    if (n > 0) printf("    class %2d: %ld block(s)\n", c, n);
+    nlisted += n;
+  }
+
+  if (nlisted != nfree) {
+    errors++;
+    printf("    --> ERROR: %ld free block(s) in heap, but %ld on free lists\n", nfree, nlisted);
+  }
+  if (free_bytes != stats.free_bytes) {
+    errors++;
+    printf("    --> ERROR: %lu free byte(s) in heap, but statistics report %lu\n",
+           free_bytes, stats.free_bytes);
+  }
+
   printf("\n");
   if ((p == heap_end) && (errors == 0)) printf("  Block structure coherent.\n");
   printf("-------------------------------------------------------------------------------------------------\n");
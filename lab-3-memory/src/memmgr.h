@@ -41,8 +41,33 @@ typedef enum {
   ap_FirstFit,                    ///< first fit allocation policy
   ap_NextFit,                     ///< next fit allocation policy
   ap_BestFit,                     ///< best fit allocation policy
+  ap_Segregated,                  ///< segregated explicit free lists (first fit per size class)
 } AllocationPolicy;
 
+#define MM_SEARCH_BUCKETS 12      ///< number of buckets in the free block search histogram
+
+/// @brief allocator statistics (see mm_stats())
+typedef struct {
+  size_t          malloc;         ///< number of mm_malloc() calls (including those by calloc/realloc)
+  size_t          calloc;         ///< number of mm_calloc() calls
+  size_t          realloc;        ///< number of mm_realloc() calls
+  size_t          free;           ///< number of mm_free() calls (including those by realloc)
+  size_t          search;         ///< number of free block searches
+  size_t          search_hist[MM_SEARCH_BUCKETS]; ///< searches by number n of examined blocks:
+                                  ///< bucket 0: n = 0, bucket i: 2^(i-1) <= n < 2^i, the last
+                                  ///< bucket holds all longer searches
+  size_t          split;          ///< number of block splits
+  size_t          coalesce;       ///< number of merges of a block with a free neighbor
+  size_t          sbrk;           ///< number of ds_sbrk() calls that moved the brk
+  size_t          mmap;           ///< number of huge blocks served from a mapping of their own
+  size_t          mmap_bytes;     ///< bytes currently mapped for huge blocks (not part of the heap)
+  size_t          heap_size;      ///< heap size in bytes
+  size_t          in_use;         ///< bytes in allocated and thread-cached blocks (incl. overhead)
+  size_t          free_bytes;     ///< bytes in free blocks
+  size_t          largest_free;   ///< size of the largest free block in bytes
+  double          fragmentation;  ///< external fragmentation, 1 - largest_free/free_bytes
+} MemStats;
+
 /// @brief initialize heap. Must be called before any of the other functions can be used.
 void mm_init(AllocationPolicy ap);
 
@@ -70,10 +95,33 @@ void* mm_realloc(void *ptr, size_t size);
 /// @param ptr pointer to allocated memory obtained by calling mm_malloc, mm_calloc, or mm_realloc
 void mm_free(void *ptr);
 
+/// @brief release free memory at the end of the heap back to the data segment (see malloc_trim)
+/// @param pad number of bytes of free space to keep at the end of the heap
+/// @retval 1 if memory was released
+/// @retval 0 otherwise
+int mm_trim(size_t pad);
+
+/// @brief retrieve the allocator statistics. The counters are maintained at all times and reset
+///        by mm_init(); computing the snapshot only walks the free list of the largest size class.
+/// @param[out] stats statistics
+void mm_stats(MemStats *stats);
+
+/// @brief set the block size above which requests are served from a mapping of their own instead
+///        of the heap (see mallopt(M_MMAP_THRESHOLD)). mm_init() resets the threshold to the value
+///        of the environment variable MM_MMAP_THRESHOLD or, if unset, to 64 KB.
+/// @param threshold block size in bytes (0: always allocate from the heap)
+void mm_setmmapthreshold(size_t threshold);
+
 /// @brief set log level
 /// @brief level log level (0: no logging, 1: info; 2: verbose)
 void mm_setloglevel(int level);
 
+/// @brief turn thread-safe mode on/off. In thread-safe mode, multiple threads may share the heap;
+///        small blocks are served from per-thread caches without locking. Only switch modes while
+///        a single thread is using the heap.
+/// @param active (1: thread-safe mode on, 0: off)
+void mm_setthreadsafe(int active);
+
 /// @brief dump heap and perform some sanity checks
 void mm_check(void);
 
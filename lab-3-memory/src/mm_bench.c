@@ -0,0 +1,300 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief trace-driven allocator benchmark
+/// @author <Park YeongSeo>
+/// @studid <2016-13006>
+//--------------------------------------------------------------------------------------------------
+
+
+// Allocator benchmark
+// ===================
+// Replays the allocation/deallocation actions of .dmas scripts against every allocation policy of
+// the memory manager and against the null driver, and reports
+//
+// - throughput (operations per second)
+// - per-operation latency (p50, p99). Each operation is timed individually; the null driver
+//   shows the timing overhead
+// - peak heap size (including the mappings of huge blocks) vs. peak payload (live bytes), i.e.,
+//   utilization
+// - number of ds_sbrk() calls
+//
+// Of the script commands, only 'dataseg' and the actions m(alloc), c(alloc), r(ealloc), and
+// f(ree) are interpreted; everything else (heap, mode, log, v, ...) is ignored.
+//
+// Usage: mm_bench [-n <repetitions>] [-o <csv file>] <script> [<script> ...]
+//
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dataseg.h"
+#include "memmgr.h"
+#include "nulldriver.h"
+
+/// @brief one action of a script
+typedef struct {
+  char            type;           ///< 'm', 'c', 'r', or 'f'
+  int             id;             ///< block id (negative: no block)
+  size_t          size;           ///< payload size (m, c, r)
+} Action;
+
+/// @brief a parsed script
+typedef struct {
+  const char      *name;          ///< file name
+  size_t          dssize;         ///< data segment size
+  Action          *action;        ///< actions
+  size_t          nactions;       ///< number of actions
+  int             maxid;          ///< largest block id
+} Trace;
+
+/// @brief an allocator under test
+typedef struct {
+  const char      *name;          ///< name of the implementation/policy
+  int             policy;         ///< AllocationPolicy, or -1 for the null driver
+  void*           (*malloc)(size_t);
+  void*           (*calloc)(size_t, size_t);
+  void*           (*realloc)(void*, size_t);
+  void            (*free)(void*);
+} Implementation;
+
+/// @brief benchmark results of one trace/implementation pair
+typedef struct {
+  size_t          ops;            ///< number of operations
+  double          time;           ///< total time spent in the allocator, in seconds
+  uint64_t        p50, p99;       ///< per-operation latency percentiles, in nanoseconds
+  size_t          peak_heap;      ///< peak heap size (brk - start of data segment, plus mapped
+                                  ///< huge blocks), in bytes
+  size_t          peak_payload;   ///< peak live payload, in bytes
+  ssize_t         nsbrk;          ///< number of ds_sbrk() calls (per repetition)
+} Result;
+
+static Implementation impl[] = {
+  { "firstfit",   ap_FirstFit,   mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { "nextfit",    ap_NextFit,    mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { "bestfit",    ap_BestFit,    mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { "segregated", ap_Segregated, mm_malloc,   mm_calloc,   mm_realloc,   mm_free   },
+  { "null",       -1,            null_malloc, null_calloc, null_realloc, null_free },
+};
+
+#define NIMPL  (sizeof(impl)/sizeof(impl[0]))          ///< number of implementations
+#define DSSIZE (64*1024*1024)                          ///< default data segment size
+
+
+/// @brief print error message and terminate process
+/// @param ... printf format string followed by its parameters
+#define PANIC(...) do { fprintf(stderr, "mm_bench: " __VA_ARGS__); fprintf(stderr, "\n"); \
+                        exit(EXIT_FAILURE); } while (0)
+
+/// @brief parse script file @a fn
+/// @param fn file name
+/// @param[out] t parsed trace
+static void load_trace(const char *fn, Trace *t)
+{
+  FILE *f = fopen(fn, "r");
+  if (f == NULL) PANIC("cannot open script '%s': %s", fn, strerror(errno));
+
+  memset(t, 0, sizeof(*t));
+  t->name = fn;
+  t->dssize = DSSIZE;
+  t->maxid = -1;
+
+  size_t capacity = 0;
+  char *line = NULL;
+  size_t llen = 0;
+  while (getline(&line, &llen, f) > 0) {
+    char cmd[16];
+    int pos;
+    if ((sscanf(line, "%15s%n", cmd, &pos) != 1) || (cmd[0] == '#')) continue;
+
+    if (strcmp(cmd, "dataseg") == 0) {
+      t->dssize = strtoul(&line[pos], NULL, 0);
+      continue;
+    }
+    if ((strlen(cmd) != 1) || (strchr("mcrf", cmd[0]) == NULL)) continue;
+
+    Action a = { .type = cmd[0], .size = 0 };
+    int n = sscanf(&line[pos], "%i %zu", &a.id, &a.size);
+    if ((n < 1) || ((a.type != 'f') && (n < 2))) PANIC("invalid action in '%s': %s", fn, line);
+
+    if (t->nactions == capacity) {
+      capacity = capacity ? 2*capacity : 1024;
+      t->action = realloc(t->action, capacity*sizeof(Action));
+      if (t->action == NULL) PANIC("out of memory");
+    }
+    t->action[t->nactions++] = a;
+    if (a.id > t->maxid) t->maxid = a.id;
+  }
+
+  free(line);
+  fclose(f);
+}
+
+/// @brief compare two latencies for qsort
+static int cmp_latency(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+/// @brief elapsed time between @a a and @a b in nanoseconds
+static uint64_t elapsed(const struct timespec *a, const struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec)*1000000000UL + b->tv_nsec - a->tv_nsec;
+}
+
+/// @brief replay trace @a t @a reps times against implementation @a im
+/// @param t trace
+/// @param im implementation
+/// @param reps number of repetitions
+/// @param[out] r results
+static void run_trace(const Trace *t, const Implementation *im, int reps, Result *r)
+{
+  size_t nblocks = t->maxid + 1;
+  void **ptr = calloc(nblocks, sizeof(void*));
+  size_t *size = calloc(nblocks, sizeof(size_t));
+  uint64_t *lat = malloc(t->nactions*reps*sizeof(uint64_t));
+  if ((ptr == NULL) || (size == NULL) || (lat == NULL)) PANIC("out of memory");
+
+  memset(r, 0, sizeof(*r));
+  uint64_t total = 0;
+
+  for (int rep = 0; rep < reps; rep++) {
+    void *ds_start, *brk;
+
+    ds_allocate(t->dssize);
+    if (im->policy >= 0) mm_init(im->policy);
+    ds_heap_stat(&ds_start, NULL, NULL);
+    memset(ptr, 0, nblocks*sizeof(void*));
+    memset(size, 0, nblocks*sizeof(size_t));
+    size_t payload = 0;
+
+    for (size_t i = 0; i < t->nactions; i++) {
+      const Action *a = &t->action[i];
+      void *p = (a->id >= 0) ? ptr[a->id] : NULL;
+      struct timespec start, end;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      switch (a->type) {
+        case 'm': p = im->malloc(a->size); break;
+        case 'c': p = im->calloc(1, a->size); break;
+        case 'r': p = im->realloc(p, a->size); break;
+        case 'f': im->free(p); p = NULL; break;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      uint64_t ns = elapsed(&start, &end);
+      lat[r->ops++] = ns;
+      total += ns;
+
+      // book-keeping of live payload
+      if (a->id >= 0) {
+        payload -= size[a->id];
+        ptr[a->id] = p;
+        size[a->id] = (p != NULL) ? a->size : 0;
+        payload += size[a->id];
+      }
+      if (payload > r->peak_payload) r->peak_payload = payload;
+
+      // the heap only grows on allocations. Huge blocks live in mappings outside the heap
+      if (a->type != 'f') {
+        ds_heap_stat(NULL, &brk, NULL);
+        size_t heap = brk - ds_start;
+        if (im->policy >= 0) {
+          MemStats ms;
+          mm_stats(&ms);
+          heap += ms.mmap_bytes;
+        }
+        if (heap > r->peak_heap) r->peak_heap = heap;
+      }
+    }
+
+    if (im->policy >= 0) r->nsbrk = ds_getnsbrk();
+    else null_stat(NULL, &r->nsbrk);
+
+    // free the blocks the script left allocated; mm_init() does not unmap huge blocks
+    for (size_t k = 0; k < nblocks; k++) {
+      if (ptr[k] != NULL) im->free(ptr[k]);
+    }
+  }
+
+  qsort(lat, r->ops, sizeof(uint64_t), cmp_latency);
+  r->time = total / 1e9;
+  r->p50 = lat[r->ops/2];
+  r->p99 = lat[r->ops*99/100];
+
+  free(lat);
+  free(size);
+  free(ptr);
+}
+
+/// @brief print program usage and terminate
+static void syntax(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-n <repetitions>] [-o <csv file>] <script> [<script> ...]\n", argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int reps = 10;
+  const char *csvfn = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:o:h")) != -1) {
+    switch (opt) {
+      case 'n': reps = atoi(optarg); break;
+      case 'o': csvfn = optarg; break;
+      default:  syntax(argv[0]);
+    }
+  }
+  if ((optind >= argc) || (reps < 1)) syntax(argv[0]);
+
+  FILE *csv = NULL;
+  if (csvfn != NULL) {
+    if ((csv = fopen(csvfn, "w")) == NULL) PANIC("cannot open '%s': %s", csvfn, strerror(errno));
+    fprintf(csv, "trace,implementation,ops,time_s,kops_per_s,p50_ns,p99_ns,"
+                 "peak_heap,peak_payload,utilization,nsbrk\n");
+  }
+
+  printf("%-20s %-11s %8s %11s %8s %8s %10s %10s %6s %6s\n",
+         "trace", "impl", "ops", "kops/sec", "p50[ns]", "p99[ns]",
+         "heap", "payload", "util", "sbrk");
+
+  for (int i = optind; i < argc; i++) {
+    Trace t;
+    load_trace(argv[i], &t);
+
+    for (size_t j = 0; j < NIMPL; j++) {
+      Result r;
+      run_trace(&t, &impl[j], reps, &r);
+
+      double kops = r.time > 0 ? r.ops / r.time / 1000.0 : 0.0;
+      double util = r.peak_heap > 0 ? 100.0 * r.peak_payload / r.peak_heap : 0.0;
+      const char *tn = strrchr(t.name, '/') ? strrchr(t.name, '/') + 1 : t.name;
+
+      printf("%-20s %-11s %8zu %11.2f %8lu %8lu %10zu %10zu %5.1f%% %6ld\n",
+             tn, impl[j].name, r.ops, kops, r.p50, r.p99,
+             r.peak_heap, r.peak_payload, util, r.nsbrk);
+      if (csv != NULL) {
+        fprintf(csv, "%s,%s,%zu,%.9f,%.2f,%lu,%lu,%zu,%zu,%.4f,%ld\n",
+                t.name, impl[j].name, r.ops, r.time, kops, r.p50, r.p99,
+                r.peak_heap, r.peak_payload, util/100.0, r.nsbrk);
+      }
+    }
+
+    free(t.action);
+  }
+
+  if (csv != NULL) fclose(csv);
+  ds_release();
+
+  return EXIT_SUCCESS;
+}
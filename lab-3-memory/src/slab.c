@@ -0,0 +1,173 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief slab allocator for fixed-size objects
+/// @author <Park YeongSeo>
+/// @studid <2016-13006>
+//--------------------------------------------------------------------------------------------------
+
+
+// Slab allocator
+// ==============
+// This module implements arenas of fixed-size objects on top of the simulated data segment.
+//
+// Slab organization:
+// ------------------
+// A slab is one page obtained with ds_sbrk(). The first word links the slabs of an arena (or the
+// released slabs); the rest of the page holds the objects without any per-object overhead.
+//
+//   slab:   +------+-------+-------+-------+-- ... --+-------+-----+
+//           | next | obj 0 | obj 1 | obj 2 |         | obj n | ??? |
+//           +------+-------+-------+-------+-- ... --+-------+-----+
+//           ^                                                      ^
+//           |<-------------------------- PAGESIZE ---------------->|
+//
+// - allocation: pop the arena's free list, otherwise carve the next object out of the current
+//   slab (bump pointer); a full slab moves on to the next slab of the arena or a new one
+// - free: push the object onto the arena's free list (the link is stored in the object)
+// - arena_reset(): forgets the free list and restarts carving at the first slab, O(1)
+// - arena_release(): moves the slabs of the arena to the list of released slabs, from where
+//   other arenas take them before growing the data segment
+//
+// The memory manager tolerates slabs between its heap blocks (see extend_heap() in memmgr.c).
+// Slabs are never returned to the data segment.
+//
+
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "dataseg.h"
+#include "slab.h"
+
+/// @name global variables
+/// @{
+static void *slab_cache      = NULL;                   ///< list of released slabs
+static int  PAGESIZE         = 0;                      ///< memory system page size
+static int  slab_initialized = 0;                      ///< initialized flag (yes: 1, otherwise 0)
+/// @}
+
+/// @name Macro definitions
+/// @{
+#define ALIGN              sizeof(void*)               ///< object alignment
+#define SLAB_HDR           sizeof(void*)               ///< size of slab header
+#define SLAB_NEXT(s)       (*(void**)(s))              ///< next slab of slab s
+#define OBJ_NEXT(o)        (*(void**)(o))              ///< next object of free object o
+/// @}
+
+
+/// @brief get an empty slab, either a released one or a new page from the data segment
+/// @retval void* pointer to slab
+/// @retval NULL if the data segment cannot be extended
+static void* get_slab(void)
+{
+  void *s = slab_cache;
+
+  if (s != NULL) {
+    slab_cache = SLAB_NEXT(s);
+  } else {
+    s = ds_sbrk(PAGESIZE);
+    if (s == (void*)-1) return NULL;
+  }
+
+  SLAB_NEXT(s) = NULL;
+  return s;
+}
+
+void slab_init(void)
+{
+  PAGESIZE = ds_getpagesize();
+  slab_cache = NULL;
+  slab_initialized = 1;
+}
+
+int arena_init(Arena *a, size_t objsize)
+{
+  assert(slab_initialized);
+  assert(a != NULL);
+
+  objsize = (objsize + ALIGN-1) / ALIGN * ALIGN;
+  if ((objsize == 0) || (objsize > PAGESIZE - SLAB_HDR)) return -1;
+
+  a->objsize = objsize;
+  a->first = a->cur = NULL;
+  a->next = a->limit = NULL;
+  a->free = NULL;
+  a->nslabs = 0;
+
+  return 0;
+}
+
+void* arena_alloc(Arena *a)
+{
+  assert(a != NULL);
+
+  void *obj = a->free;
+
+  // 1. reuse a freed object
+  if (obj != NULL) {
+    a->free = OBJ_NEXT(obj);
+    return obj;
+  }
+
+  // 2. current slab exhausted: continue with the next slab of the arena (retained by
+  //    arena_reset()) or append a new one
+  if (a->next + a->objsize > a->limit) {
+    void *s = (a->cur != NULL) ? SLAB_NEXT(a->cur) : a->first;
+
+    if (s == NULL) {
+      if ((s = get_slab()) == NULL) return NULL;
+
+      if (a->cur != NULL) SLAB_NEXT(a->cur) = s;
+      else a->first = s;
+      a->nslabs++;
+    }
+
+    a->cur = s;
+    a->next = s + SLAB_HDR;
+    a->limit = s + PAGESIZE;
+  }
+
+  // 3. carve the next object
+  obj = a->next;
+  a->next += a->objsize;
+
+  return obj;
+}
+
+void arena_free(Arena *a, void *obj)
+{
+  assert(a != NULL);
+
+  if (obj == NULL) return;
+
+  OBJ_NEXT(obj) = a->free;
+  a->free = obj;
+}
+
+void arena_reset(Arena *a)
+{
+  assert(a != NULL);
+
+  a->cur = NULL;
+  a->next = a->limit = NULL;
+  a->free = NULL;
+}
+
+void arena_release(Arena *a)
+{
+  assert(a != NULL);
+
+  if (a->first != NULL) {
+    void *last = a->first;
+    while (SLAB_NEXT(last) != NULL) last = SLAB_NEXT(last);
+
+    SLAB_NEXT(last) = slab_cache;
+    slab_cache = a->first;
+  }
+
+  a->first = NULL;
+  a->nslabs = 0;
+  arena_reset(a);
+}
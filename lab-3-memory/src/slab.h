@@ -0,0 +1,59 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief slab allocator for fixed-size objects
+/// @author <Park YeongSeo>
+/// @studid <2016-13006>
+//--------------------------------------------------------------------------------------------------
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+/// @brief arena of fixed-size objects. The structure is owned by the caller; all objects live in
+///        page-sized slabs carved out of the data segment.
+typedef struct __arena {
+  size_t          objsize;        ///< size of one object in bytes (aligned)
+  void            *first;         ///< first slab of the arena
+  void            *cur;           ///< slab objects are currently carved from
+  void            *next;          ///< next uncarved object in cur
+  void            *limit;         ///< end of the object area of cur
+  void            *free;          ///< intrusive list of freed objects
+  size_t          nslabs;         ///< number of slabs owned by the arena
+} Arena;
+
+/// @brief initialize the slab allocator. Must be called after ds_allocate() and before any other
+///        arena function; slabs of a previous data segment are forgotten. If the memory manager
+///        shares the data segment, mm_init() must be called first.
+void slab_init(void);
+
+/// @brief initialize arena @a a for objects of @a objsize bytes
+/// @param a arena
+/// @param objsize object size in bytes
+/// @retval 0 on success
+/// @retval -1 if @a objsize is 0 or does not fit into a slab
+int arena_init(Arena *a, size_t objsize);
+
+/// @brief allocate one object from arena @a a
+/// @param a arena
+/// @retval void* pointer to the object on success
+/// @retval NULL if the data segment is exhausted
+void* arena_alloc(Arena *a);
+
+/// @brief return object @a obj to arena @a a
+/// @param a arena
+/// @param obj object previously obtained from arena_alloc(a)
+void arena_free(Arena *a, void *obj);
+
+/// @brief free all objects of arena @a a at once. The arena keeps its slabs for reuse.
+/// @param a arena
+void arena_reset(Arena *a);
+
+/// @brief free all objects of arena @a a and hand its slabs back to the slab allocator, where
+///        other arenas can reuse them. @a a must be re-initialized before it is used again.
+/// @param a arena
+void arena_release(Arena *a);
+
+#endif // __SLAB_H__
@@ -0,0 +1,219 @@
+//--------------------------------------------------------------------------------------------------
+// System Programming                       Memory Lab                                   Fall 2021
+//
+/// @file
+/// @brief slab allocator test program
+/// @author <Park YeongSeo>
+/// @studid <2016-13006>
+//--------------------------------------------------------------------------------------------------
+
+
+// Slab allocator test
+// ===================
+// Exercises the arenas of the slab allocator on a private data segment and checks
+//
+// - carving: objects spanning several slabs are aligned, lie inside the data segment, and do not
+//   overlap (every object is filled with a pattern that is verified afterwards)
+// - free/reuse: objects freed in mixed order are handed out again (LIFO) without new slabs
+// - arena_reset(): carving restarts at the first slab and yields the same objects again
+// - arena_release(): another arena takes over the released slabs before the segment grows
+// - exhaustion: arena_alloc() returns NULL once the data segment is full
+//
+// Usage: slab_test
+// The exit code is the number of failed checks.
+//
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dataseg.h"
+#include "slab.h"
+
+#define NSLABS  5                                      ///< slabs to fill in the carving test
+#define OBJSIZE 20                                     ///< requested object size (not aligned)
+#define DSSIZE  (1024*1024)                            ///< data segment size
+
+static int nfailed = 0;                                ///< number of failed checks
+
+/// @brief check condition @a cond and report a failure with message @a ...
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); \
+                                             nfailed++; } } while (0)
+
+/// @brief current break of the data segment
+static void* brk_now(void)
+{
+  void *brk;
+  ds_heap_stat(NULL, &brk, NULL);
+  return brk;
+}
+
+/// @brief compare two pointers for qsort
+static int cmp_ptr(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t)*(void* const*)a, y = (uintptr_t)*(void* const*)b;
+  return (x > y) - (x < y);
+}
+
+/// @brief allocate @a n objects from arena @a a into @a obj and fill object i with pattern i
+/// @retval number of objects allocated
+static size_t fill(Arena *a, void **obj, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if ((obj[i] = arena_alloc(a)) == NULL) break;
+    memset(obj[i], (int)(i & 0xff), a->objsize);
+  }
+
+  return i;
+}
+
+/// @brief check that the @a n objects in @a obj are aligned, lie in the data segment, do not
+///        overlap, and still hold the pattern written by fill()
+static void check_objects(const Arena *a, void **obj, size_t n)
+{
+  void *start, *brk;
+  ds_heap_stat(&start, &brk, NULL);
+
+  for (size_t i = 0; i < n; i++) {
+    unsigned char *p = obj[i];
+
+    CHECK((uintptr_t)p % sizeof(void*) == 0, "object %zu at %p is not aligned", i, p);
+    CHECK((p >= (unsigned char*)start) && (p + a->objsize <= (unsigned char*)brk),
+          "object %zu at %p is outside the data segment [%p, %p)", i, p, start, brk);
+    for (size_t j = 0; j < a->objsize; j++) {
+      if (p[j] != (unsigned char)(i & 0xff)) {
+        CHECK(0, "object %zu at %p was overwritten at offset %zu", i, p, j);
+        break;
+      }
+    }
+  }
+
+  void **sorted = malloc(n*sizeof(void*));
+  if (sorted == NULL) { printf("out of memory\n"); exit(EXIT_FAILURE); }
+  memcpy(sorted, obj, n*sizeof(void*));
+  qsort(sorted, n, sizeof(void*), cmp_ptr);
+  for (size_t i = 1; i < n; i++) {
+    CHECK((char*)sorted[i] - (char*)sorted[i-1] >= (ptrdiff_t)a->objsize,
+          "objects at %p and %p overlap", sorted[i-1], sorted[i]);
+  }
+  free(sorted);
+}
+
+int main(void)
+{
+  Arena a, b;
+
+  ds_setloglevel(0);
+  ds_allocate(DSSIZE);
+  slab_init();
+
+  int pagesize = ds_getpagesize();
+
+  // 1. object sizes
+  printf("arena_init()...\n");
+  CHECK(arena_init(&a, 0) < 0, "object size 0 accepted");
+  CHECK(arena_init(&a, pagesize) < 0, "object size %d (page) accepted", pagesize);
+  CHECK(arena_init(&a, pagesize - sizeof(void*)) == 0, "largest object size rejected");
+  CHECK(arena_init(&a, OBJSIZE) == 0, "object size %d rejected", OBJSIZE);
+  CHECK(a.objsize % sizeof(void*) == 0, "object size %zu is not aligned", a.objsize);
+
+  size_t perslab = (pagesize - sizeof(void*)) / a.objsize;
+  size_t n = NSLABS*perslab;
+  void **obj = malloc((n+1)*sizeof(void*));
+  void **again = malloc((n+1)*sizeof(void*));
+  if ((obj == NULL) || (again == NULL)) { printf("out of memory\n"); exit(EXIT_FAILURE); }
+
+  // 2. carve objects out of several slabs
+  printf("arena_alloc(): %zu objects of %zu bytes in %d slabs...\n", n, a.objsize, NSLABS);
+  void *brk0 = brk_now();
+  CHECK(fill(&a, obj, n) == n, "data segment exhausted");
+  CHECK(a.nslabs == NSLABS, "%zu slabs used, expected %d", a.nslabs, NSLABS);
+  CHECK((char*)brk_now() - (char*)brk0 == NSLABS*pagesize, "data segment grew by %td bytes",
+        (char*)brk_now() - (char*)brk0);
+  check_objects(&a, obj, n);
+
+  // 3. free in mixed order: every third object, then the others backwards. Reallocation
+  //    returns the freed objects in reverse order of freeing and needs no new slab.
+  printf("arena_free()/arena_alloc(): reuse of freed objects...\n");
+  size_t nfree = 0;
+  void **order = malloc(n*sizeof(void*));
+  if (order == NULL) { printf("out of memory\n"); exit(EXIT_FAILURE); }
+  for (size_t i = 0; i < n; i += 3) { arena_free(&a, obj[i]); order[nfree++] = obj[i]; }
+  for (size_t i = n; i-- > 0; ) {
+    if (i % 3 != 0) { arena_free(&a, obj[i]); order[nfree++] = obj[i]; }
+  }
+  arena_free(&a, NULL);
+
+  void *brk1 = brk_now();
+  CHECK(fill(&a, again, n) == n, "data segment exhausted");
+  for (size_t i = 0; i < n; i++) {
+    if (again[i] != order[n-1-i]) {
+      CHECK(0, "allocation %zu returned %p, expected freed object %p", i, again[i],
+            order[n-1-i]);
+      break;
+    }
+  }
+  CHECK(a.nslabs == NSLABS, "%zu slabs used after reuse, expected %d", a.nslabs, NSLABS);
+  CHECK(brk_now() == brk1, "data segment grew while freed objects were available");
+  check_objects(&a, again, n);
+
+  // 4. one more object needs a new slab
+  CHECK((obj[n] = arena_alloc(&a)) != NULL, "data segment exhausted");
+  CHECK(a.nslabs == NSLABS+1, "%zu slabs used, expected %d", a.nslabs, NSLABS+1);
+
+  // 5. reset: carving restarts at the first slab and yields the objects of step 2 again
+  printf("arena_reset()...\n");
+  arena_reset(&a);
+  void *brk2 = brk_now();
+  CHECK(fill(&a, again, n+1) == n+1, "data segment exhausted");
+  for (size_t i = 0; i < n; i++) {
+    if (again[i] != obj[i]) {
+      CHECK(0, "allocation %zu after reset returned %p, expected %p", i, again[i], obj[i]);
+      break;
+    }
+  }
+  CHECK(a.nslabs == NSLABS+1, "%zu slabs used after reset, expected %d", a.nslabs, NSLABS+1);
+  CHECK(brk_now() == brk2, "data segment grew after reset");
+  check_objects(&a, again, n+1);
+
+  // 6. release: a second arena takes over the slabs before the data segment grows
+  printf("arena_release()...\n");
+  arena_release(&a);
+  CHECK(a.nslabs == 0, "released arena still owns %zu slabs", a.nslabs);
+  CHECK(arena_init(&b, 2*OBJSIZE) == 0, "object size %d rejected", 2*OBJSIZE);
+
+  size_t nb = (NSLABS+1)*((pagesize - sizeof(void*)) / b.objsize);
+  void **objb = malloc(nb*sizeof(void*));
+  if (objb == NULL) { printf("out of memory\n"); exit(EXIT_FAILURE); }
+  void *brk3 = brk_now();
+  CHECK(fill(&b, objb, nb) == nb, "data segment exhausted");
+  CHECK(b.nslabs == NSLABS+1, "%zu slabs used, expected %d", b.nslabs, NSLABS+1);
+  CHECK(brk_now() == brk3, "data segment grew although released slabs were available");
+  check_objects(&b, objb, nb);
+  CHECK(arena_alloc(&b) != NULL, "data segment exhausted");
+  CHECK(brk_now() != brk3, "data segment did not grow once the released slabs were used");
+
+  // 7. exhaustion: the break stays below the end of the data segment, so a segment of
+  //    NSLABS+1 pages holds exactly NSLABS slabs
+  printf("arena_alloc(): exhaustion of the data segment...\n");
+  ds_allocate((NSLABS+1)*pagesize);
+  slab_init();
+  CHECK(arena_init(&a, OBJSIZE) == 0, "object size %d rejected", OBJSIZE);
+  size_t cnt = fill(&a, obj, n+1);
+  CHECK(cnt == n, "%zu objects fit into %d slabs, expected %zu", cnt, NSLABS, n);
+  CHECK(arena_alloc(&a) == NULL, "allocation from a full data segment succeeded");
+  check_objects(&a, obj, cnt);
+
+  ds_release();
+  free(objb);
+  free(order);
+  free(again);
+  free(obj);
+
+  printf("%s: %d check(s) failed\n", nfailed ? "FAILED" : "PASSED", nfailed);
+  return nfailed;
+}
@@ -7,6 +7,11 @@
 /// @section changelog Change Log
 /// 2020/11/14 Bernhard Egger adapted from CS:APP lab
 /// 2021/11/03 Bernhard Egger improved for 2021 class
+/// 2021/12/18 Park YeongSeo sigsuspend-based foreground wait
+/// 2021/12/19 Park YeongSeo hashed, dynamically sized job table
+/// 2021/12/20 Park YeongSeo posix_spawn-based command launch, command path cache
+/// 2021/12/21 Park YeongSeo batch mode (-f) and per-command timing report (-t)
+/// 2021/12/22 Park YeongSeo allocation-free command line parser
 ///
 /// @section license_section License
 /// Copyright CS:APP authors
@@ -38,10 +43,16 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdint.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -51,7 +62,10 @@
 // Limits and constant definitions
 //
 #define MAXLINE    1024      ///< max. length of command line
-#define MAXJOBS      16      ///< max. number of jobs at any point in time
+#define JOBTAB_INIT  16      ///< initial number of job table buckets (power of two)
+#define PATHTAB_SIZE 64      ///< number of command path cache buckets
+#define DEFPATH "/bin:/usr/bin"  ///< search path if PATH is not set
+#define READBUF   65536      ///< size of the batch mode read buffer
 
 /// @name job states
 /// @{
@@ -82,11 +96,67 @@
 /// @brief Job struct containing information about a job
 typedef struct job_t {
   pid_t pid;                 ///< group ID of process group. GID must be PID of last process in pipe
-  int jid;                   ///< job ID [ 1, 2, ..., MAXJOBS ]
+  int jid;                   ///< job ID [ 1, 2, ... ]
   int state;                 ///< job state (UNDEF, BG, FG, or ST)
-  char cmdline[MAXLINE];     ///< command line
+  char *cmdline;             ///< command line (heap-allocated)
+  struct job_t *pnext;       ///< next job in the same PID hash bucket
+  struct job_t *jnext;       ///< next job in the same job ID hash bucket
+  struct job_t *prev;        ///< previous job in job ID order
+  struct job_t *next;        ///< next job in job ID order, or next deleted job
 } Job;
 
+/// @brief Job table. Jobs are found by PID and by job ID through two chained hash tables that
+///        double their number of buckets whenever there are more jobs than buckets, so the number
+///        of jobs is only limited by memory. All jobs are also kept in a list in job ID order
+///        (new jobs always get the largest job ID) and the foreground job is cached.
+///
+///        The SIGCHLD handler deletes jobs; it must never run concurrently with a modification of
+///        the table, hence SIGCHLD is blocked while the shell modifies or iterates the table.
+///        Since the handler may not call free(), deleted jobs are unlinked and moved to the list
+///        of dead jobs, which is freed by addjob().
+typedef struct jobtable_t {
+  Job **pidtab;              ///< PID hash buckets
+  Job **jidtab;              ///< job ID hash buckets
+  unsigned int nbuckets;     ///< number of buckets in each hash table (power of two)
+  unsigned int njobs;        ///< number of jobs
+  Job *first;                ///< job with the smallest job ID
+  Job *last;                 ///< job with the largest job ID
+  Job *fg;                   ///< foreground job or NULL
+  Job *dead;                 ///< deleted jobs that have not been freed yet
+} JobTable;
+
+/// @brief Command path cache entry: maps a command name to the executable found in PATH
+typedef struct pathent_t {
+  char *name;                ///< command name
+  char *path;                ///< full path of the executable
+  struct pathent_t *next;    ///< next entry in the same bucket
+} PathEnt;
+
+/// @brief Buffered line reader for batch mode
+typedef struct reader_t {
+  int fd;                    ///< file descriptor of the script
+  size_t pos;                ///< position of the first unconsumed byte in buf
+  size_t len;                ///< number of valid bytes in buf
+  char buf[READBUF];         ///< read buffer
+} Reader;
+
+/// @brief Parser arena. One block holds the command array, the argv arrays, and a copy of the
+///        command line in which the tokens are NUL-terminated. It is reused for every command
+///        line and only grows when a line does not fit.
+typedef struct linearena_t {
+  void *buf;                 ///< arena memory
+  size_t size;               ///< size of buf in bytes
+} LineArena;
+
+/// @brief Timing of one command line (-t)
+typedef struct timing_t {
+  uint64_t parse;            ///< time spent in parseline() [ns]
+  uint64_t spawn;            ///< time to launch all processes of the job [ns]
+  uint64_t wall;             ///< wall time of eval(), including the wait for a foreground job [ns]
+  struct timeval utime;      ///< user time of the children reaped meanwhile
+  struct timeval stime;      ///< system time of the children reaped meanwhile
+} Timing;
+
 
 //--------------------------------------------------------------------------------------------------
 // Global variables
@@ -94,10 +164,22 @@ typedef struct job_t {
 
 char prompt[] = "csapsh> ";  ///< command line prompt (DO NOT CHANGE)
 int emit_prompt = 1;         ///< 1: emit prompt; 0: do not emit prompt
+int batch = 0;               ///< 1: batch mode, commands are read from a script (no prompt)
 int verbose = 0;             ///< 1: verbose mode; 0: normal mode
 int nextjid = 1;             ///< next job ID to allocate
 
-Job jobs[MAXJOBS];           ///< the job list
+JobTable jobs;               ///< the job list
+LineArena linearena;         ///< arena of parseline()
+
+PathEnt *pathtab[PATHTAB_SIZE]; ///< command path cache
+char *pathtab_path = NULL;   ///< value of PATH the command path cache was filled from
+
+int timing = 0;              ///< 1: print a timing report for every command; 0: don't
+Timing cmdtime;              ///< timing of the current command line
+Timing totaltime;            ///< accumulated timing of all command lines
+unsigned long ncmds = 0;     ///< number of timed command lines
+struct timeval child_utime;  ///< accumulated user time of all reaped children
+struct timeval child_stime;  ///< accumulated system time of all reaped children
 
 
 //--------------------------------------------------------------------------------------------------
@@ -122,16 +204,30 @@ void sigtstp_handler(int sig);
 int parseline(const char *cmdline, char ****argv, char **outfile);
 
 // Job list manipulation functions
-void clearjob(Job *job);
-void initjobs(Job *jobs);
-int maxjid(Job *jobs);
-int addjob(Job *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(Job *jobs, pid_t pid);
-pid_t fgpid(Job *jobs);
-Job *getjobpid(Job *jobs, pid_t pid);
-Job *getjobjid(Job *jobs, int jid);
+void freejobs(JobTable *jobs);
+void initjobs(JobTable *jobs);
+int maxjid(JobTable *jobs);
+int addjob(JobTable *jobs, pid_t pid, int state, char *cmdline);
+int deletejob(JobTable *jobs, pid_t pid);
+void setjobstate(JobTable *jobs, Job *job, int state);
+pid_t fgpid(JobTable *jobs);
+Job *getjobpid(JobTable *jobs, pid_t pid);
+Job *getjobjid(JobTable *jobs, int jid);
 int pid2jid(pid_t pid);
-void listjobs(Job *jobs);
+void listjobs(JobTable *jobs);
+
+// Command launch
+char* pathlookup(const char *name);
+void pathforget(const char *name);
+void pathflush(void);
+int spawncmd(char *argv[], int in, int out, const sigset_t *mask, pid_t *pid);
+
+// Batch mode and timing
+uint64_t nsec(void);
+ssize_t readline(Reader *r, char *line, size_t size);
+int isdirective(const char *cmdline);
+void evaltimed(char *cmdline);
+void timingsummary(void);
 
 // Helper functions
 void usage(const char *program);
@@ -152,13 +248,15 @@ int main(int argc, char **argv)
 {
   char c;
   char cmdline[MAXLINE];
+  char *script = NULL;
+  Reader *in = NULL;
 
   // redirect stderr to stdout so that the driver will get all output 
   // on the pipe connected to stdout.
   dup2(STDOUT_FILENO, STDERR_FILENO);
 
   // parse command line
-  while ((c = getopt(argc, argv, "hvp")) != EOF) {
+  while ((c = getopt(argc, argv, "hvpf:t")) != EOF) {
     switch (c) {
       case 'h': usage(argv[0]);   // print help message
                 break;
@@ -166,6 +264,11 @@ int main(int argc, char **argv)
                 break;
       case 'p': emit_prompt = 0;  // don't print a prompt
                 break;            // handy for automatic testing
+      case 'f': script = optarg;  // batch mode: execute script
+                batch = 1;
+                break;
+      case 't': timing = 1;       // print per-command timing report
+                break;
       default:  usage(argv[0]);   // invalid option -> print help message
     }
   }
@@ -178,24 +281,47 @@ int main(int argc, char **argv)
   Signal(SIGQUIT, sigquit_handler);   // Ctrl-Backslash (useful to exit shell)
 
   // initialize job list
-  initjobs(jobs);
+  initjobs(&jobs);
+
+  // open script in batch mode. The script is read through its own close-on-exec descriptor,
+  // so children keep the shell's stdin and cannot consume the script.
+  if (script != NULL) {
+    if ((in = malloc(sizeof(Reader))) == NULL) app_error("out of memory");
+    if ((in->fd = open(script, O_RDONLY | O_CLOEXEC)) < 0) unix_error(script);
+    in->pos = in->len = 0;
+  }
+
+  if (timing) atexit(timingsummary);  // also reached through the quit command
 
   // execute read/eval loop
   VERBOSE("Execute read/eval loop...");
   while (1) {
-    if (emit_prompt) { printf("%s", prompt); fflush(stdout); }
+    if (in != NULL) {
+      ssize_t len = readline(in, cmdline, MAXLINE);
+      if (len < 0) unix_error("read error");
+      if (len == 0) break;      // end of script
+      if (isdirective(cmdline)) continue;
+    } else {
+      if (emit_prompt) { printf("%s", prompt); fflush(stdout); }
+
+      if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin)) {
+        app_error("fgets error");
+      }
 
-    if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin)) {
-      app_error("fgets error");
+      if (feof(stdin)) break;   // end of input (Ctrl-d)
     }
 
-    if (feof(stdin)) break;   // end of input (Ctrl-d)
-
-    eval(cmdline);
+    if (timing) evaltimed(cmdline);
+    else eval(cmdline);
   
 	fflush(stdout);
   }
 
+  if (in != NULL) {
+    close(in->fd);
+    free(in);
+  }
+
   // that's all, folks!
   return EXIT_SUCCESS;
 }
@@ -224,21 +350,6 @@ void dump_cmdstruct(char ***cmd, char *outfile, int mode)
   printf("Command runs in %sground.\n", mode == BG ? "back" : "fore");
 }
 
-/// @brief Free a parsed command structure
-/// @param cmd array of char *argv[] arrays obtained by calling @a parseline
-void free_cmdstruct(char ***cmd)
-{
-  if (cmd == NULL) return;
-
-  int cmd_idx = 0, arg_idx;
-
-  while (cmd[cmd_idx] != NULL) {
-    arg_idx = 0;
-    while (cmd[cmd_idx][arg_idx] != NULL) free(cmd[cmd_idx][arg_idx++]);
-    free(cmd[cmd_idx++]);
-  }
-}
-
 /// @brief Evaluate the command line. The function @a parseline() does the heavy lifting of parsing
 ///        the command line and splitting it into separate char *argv[] arrays that represent
 ///        individual commands with their arguments. 
@@ -252,80 +363,69 @@ void free_cmdstruct(char ***cmd)
 /// @param cmdline command line
 void eval(char *cmdline)
 {
-  char *str = strdup(cmdline);
-  VERBOSE("eval(%s)", stripnewline(str));
-  free(str);
+  VERBOSE("eval(%.*s)", (int)strcspn(cmdline, "\n"), cmdline);
   char ***argv = NULL;
   char *outfile = NULL;
+  uint64_t start = nsec();
   int mode = parseline(cmdline, &argv, &outfile);
+  cmdtime.parse = nsec() - start;
   if (mode == -1) return;      // parse error
   if (argv == NULL) return;    // no input
 
   // TODO
   //dump_cmdstruct(argv, outfile, mode);
   if (!builtin_cmd(argv[0])){ //If name is a built-in command, then csapsh should handle it immediately and wait for the next command line
-    sigset_t mask;
-    pid_t pid;
+    sigset_t mask, prev, child;
+    pid_t pid = 0;
     int cmdCount = getCmdCount(argv);
-    int fp[512][2];
-    
+    int in = STDIN_FILENO, out, fd = -1, fp[2];
+
     sigemptyset(&mask); //initialize the signal mask
     sigaddset(&mask, SIGCHLD); //add SIGCHLD signal to the set
-    sigprocmask(SIG_BLOCK, &mask, NULL); // block
+    sigprocmask(SIG_BLOCK, &mask, &prev); // block
+    child = prev; //children run with the shell's mask, but SIGCHLD unblocked
+    sigdelset(&child, SIGCHLD);
+
+    if (outfile != NULL){ //redirection applies to the last command
+      fd = open(outfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, S_IRWXU|S_IRWXG|S_IRWXO);
+      if (fd < 0){
+        printf("open error: %s\n", strerror(errno));
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+      }
+    }
 
-    for (int i = 0; i < cmdCount -1; i++) if (pipe(fp[i])); //we need cmdCount - 1 pipes. make them. 
+    start = nsec();
 
+    //spawn the commands one by one; each one reads from the pipe created for its predecessor.
+    //All pipe ends are close-on-exec, so a child only keeps what is dup'ed onto stdin/stdout.
     for (int i = 0; i < cmdCount; i++){
-      sigprocmask(SIG_BLOCK, &mask, NULL); // block
+      if (i < cmdCount - 1){
+        if (pipe2(fp, O_CLOEXEC) < 0) unix_error("pipe error");
+        out = fp[WRITE];
+      }
+      else out = fd >= 0 ? fd : STDOUT_FILENO;
 
-      if ((pid = fork()) < 0) {// failed to fork
-        unix_error("fork error");
+      int res = spawncmd(argv[i], in, out, &child, &pid);
+      if (res != 0){
+        printf("%s\n", strerror(res));
+        pid = 0;
       }
-      if (!pid){// child process
-        setpgid(0,0);
-        sigprocmask(SIG_UNBLOCK, &mask, NULL);
-        
-        if (i > 0) if (dup2(fp[i-1][READ], STDIN_FILENO) < 0) unix_error("dup2 error"); //if it is not the first command, connect input to its previous READ port
-
-        if (i == cmdCount - 1){ //redircet occurs only at the last command
-          if (outfile != NULL){ // if there's an outfile needed, open, redirect, close.
-            int fd = open(outfile, O_WRONLY|O_TRUNC|O_CREAT, S_IRWXU|S_IRWXG|S_IRWXO);
-            if (fd < 0) unix_error("open error");
-            if (dup2(fd, STDOUT_FILENO) < 0) unix_error("dup2 error");
-            close(fd);
-          }
-        }
-        else if (dup2(fp[i][WRITE], STDOUT_FILENO) < 0) unix_error("dup2 error"); //if it is not the last comand, connect output to its WRITE port
 
-        for (int j = 0; j < cmdCount - 1; j++){//close every pipe fd
-          close(fp[j][WRITE]);
-          close(fp[j][READ]);
-        }
+      if (in != STDIN_FILENO) close(in);
+      if (out != STDOUT_FILENO) close(out);
+      if (i < cmdCount - 1) in = fp[READ];
+    }
 
-        execve(argv[i][0], argv[i], environ); //if there's no error, no return
-        execvp(argv[i][0], argv[i]);          //if the command is not a PATH but a name of the FILE
-        app_error("No such file or directory");
-        
-      }
+    cmdtime.spawn = nsec() - start;
 
-      //parent  
-      if (i == cmdCount - 1){ //at the end, close all pipes and add jobs.
-        for (int j = 0; j < cmdCount - 1; j++){
-          close(fp[j][WRITE]);
-          close(fp[j][READ]);
-        }
+    //the job is identified by the last process of the pipe
+    if (pid > 0) addjob(&jobs, pid, mode, cmdline);
+    sigprocmask(SIG_SETMASK, &prev, NULL);
 
-        if (mode == FG){//foreground
-          addjob(jobs, pid, FG, cmdline); //note that gid is a pid of the last pipe
-          sigprocmask(SIG_UNBLOCK, &mask, NULL);
-          waitfg(pid); //wait for child processes
-        }
-        else if (mode == BG) {//background
-          addjob(jobs, pid, BG, cmdline);
-          sigprocmask(SIG_UNBLOCK, &mask, NULL);
-          printf("[%d] (%d) %s", pid2jid(pid), emit_prompt ? pid : -1, cmdline);
-        }
-      }
+    if (pid > 0){
+      if (mode == FG) waitfg(pid); //wait for child processes
+      else printf("[%d] (%d) %s", pid2jid(pid), emit_prompt ? pid : -1, cmdline);
     }
   }
 }
@@ -337,16 +437,21 @@ void eval(char *cmdline)
 /// @retval 0 otherwise
 int builtin_cmd(char *argv[])
 {
+  sigset_t mask, prev;
+  int builtin = 1;
+
   if (!strcmp(argv[0], "quit")) exit(EXIT_SUCCESS); //quit
-  if (!strcmp(argv[0], "fg") || !strcmp(argv[0], "bg")){ //bg or fg
-      do_bgfg(argv); 
-      return 1;
-  }
-  if (!strcmp(argv[0], "jobs")) { //list jobs
-    listjobs(jobs);
-    return 1;
-  }
-  return 0;
+
+  sigemptyset(&mask);         // the job table must not change under our feet
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+
+  if (!strcmp(argv[0], "fg") || !strcmp(argv[0], "bg")) do_bgfg(argv); //bg or fg
+  else if (!strcmp(argv[0], "jobs")) listjobs(&jobs); //list jobs
+  else builtin = 0;
+
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+  return builtin;
 }
 
 /// @brief Execute the builtin bg and fg commands
@@ -364,14 +469,14 @@ void do_bgfg(char *argv[])
   struct job_t *job;
 
   if (isJID) {
-    job = getjobjid(jobs, PIDJID);
+    job = getjobjid(&jobs, PIDJID);
     if (job == NULL) {
       printf("[%%%d]: No such job\n", PIDJID);
       return;
     }
   }
   else {
-    job = getjobpid(jobs, PIDJID);
+    job = getjobpid(&jobs, PIDJID);
     if (job == NULL){
       printf("(%d): No such process\n", PIDJID);
       return;
@@ -379,25 +484,35 @@ void do_bgfg(char *argv[])
   }
 
   if (!strcmp(argv[0], "bg")){ // run a stopped job in the background
-    job->state = BG; // change the state of a job (ST -> BG)
+    setjobstate(&jobs, job, BG); // change the state of a job (ST -> BG)
     printf("[%d] (%d) %s", job->jid, emit_prompt ? job->pid : - 1, job->cmdline);
     kill(-(job->pid), SIGCONT);
   }
   else if (!strcmp(argv[0], "fg")){ // run a stopped job in the foreground
-    job->state = FG; // (ST -> FG)
+    setjobstate(&jobs, job, FG); // (ST -> FG)
     kill(-(job->pid), SIGCONT);
     waitfg(job->pid); //wait
   }
 }
 
-/// @brief Block until process pid is no longer the foreground process
+/// @brief Block until process pid is no longer the foreground process. SIGCHLD is blocked while
+///        the job list is checked and atomically unblocked while waiting, so that a child that
+///        terminates or stops between the check and the wait is not missed.
 /// @param pid PID of foreground process
 void waitfg(pid_t pid)
 {
-	while(1){  //use a busy loop around the sleep function
-  	if (pid != fgpid(jobs)) return;   //at most one foreground process
-		sleep(1);
-	}
+  sigset_t mask, prev, wait;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+
+  wait = prev;                    // wait with the caller's mask, but SIGCHLD unblocked
+  sigdelset(&wait, SIGCHLD);
+
+  while (pid == fgpid(&jobs)) sigsuspend(&wait); //woken up by sigchld_handler
+
+  sigprocmask(SIG_SETMASK, &prev, NULL);
 }
 
 
@@ -412,18 +527,25 @@ void sigchld_handler(int sig)
 {
   pid_t pid ;
   int status;
-   //use exactly one call to waitpid
-  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0){
+  Job *job;
+  struct rusage ru;
+   //use exactly one call to wait4 (waitpid that also returns the child's resource usage)
+  while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru)) > 0){
+    if (!WIFSTOPPED(status)){//account CPU time of terminated children
+      timeradd(&child_utime, &ru.ru_utime, &child_utime);
+      timeradd(&child_stime, &ru.ru_stime, &child_stime);
+    }
+
     if (WIFEXITED(status)){//a child process terminated normally
-      deletejob(jobs, pid);
+      deletejob(&jobs, pid);
     }
 
     if (WIFSTOPPED(status)){//a child process stopped because of SIGSTOP/STP
-      getjobpid(jobs, pid)->state = ST;
+      if ((job = getjobpid(&jobs, pid)) != NULL) setjobstate(&jobs, job, ST);
     }
     if (WIFSIGNALED(status)){//a child process is terminated by a signal.
       printf("a process (%d) is killed by a signal #%d\n", pid, WTERMSIG(status));
-      deletejob(jobs, pid);
+      deletejob(&jobs, pid);
     }
   }
 
@@ -435,7 +557,7 @@ void sigchld_handler(int sig)
 /// @param sig signal (SIGINT)
 void sigint_handler(int sig)
 {
-  pid_t pid = fgpid(jobs); // the foregorund job pid
+  pid_t pid = fgpid(&jobs); // the foregorund job pid
 
   if (pid) kill(-pid, sig); //forward the signal to the forground job
 }
@@ -445,7 +567,7 @@ void sigint_handler(int sig)
 /// @param sig signal (SIGTSTP)
 void sigtstp_handler(int sig)
 {
-  pid_t pid = fgpid(jobs); // the foreground job pid
+  pid_t pid = fgpid(&jobs); // the foreground job pid
 
   if (pid) kill(-pid, sig);// forward
 
@@ -477,20 +599,13 @@ void sigtstp_handler(int sig)
 //
 //   csapsh> ls -l /tmp | sort | shuf > listing.txt &
 //
+// parseline does not allocate memory per command or argument. The command line is copied into
+// the parser arena and the tokens are NUL-terminated in place; the argv arrays are carved from the
+// same block. A command line of length n has at most n tokens and n/2+1 commands, so n+2 pointers
+// suffice for each of the command array and the (concatenated, NULL-terminated) argv arrays.
+//
 
-/// @brief Returns true if char @a c is a regular delimiter (space, tab, '|', or '>') or matches
-///        the specific delimiter @a extra.
-/// @param c character to examine
-/// @param extra specific delimiter
-/// @retval true if extra==NONE and @a c is a regular delimiter (' ', '\t', '|', '>')
-/// @retval true if extra!=NONE and @a c == @a extra
-/// @retval false otherwise
-#define NONE '\0'
-int isdelim(char c, char extra)
-{
-  return ((extra == NONE) && ((c == ' ') || (c == '\t') || (c == '|') || (c == '>'))) ||
-         (c == extra);
-}
+#define NONE '\0'             ///< no quote
 
 /// @brief Skip over whitespace in string @a str starting at position @a pos. Returns the position
 ///        of the first non-whitespace character (or the \0 byte).
@@ -514,7 +629,7 @@ int parseline_error(const char *cmdline, int pos, int error)
 {
   assert(pos >= 0);
 
-  if (emit_prompt) pos+=(int)strlen(prompt);
+  if (emit_prompt && !batch) pos+=(int)strlen(prompt); // the command line follows the prompt
   else printf("%s", cmdline);
   printf("%*s^\n", pos, " ");
   switch (error) {
@@ -545,6 +660,8 @@ int parseline_error(const char *cmdline, int pos, int error)
 /// @param cmdline command line to parse
 /// @param[out] argv NULL-terminated array of 'char *argv[]' arrays suitable for the execv family
 /// @param[out] outfile NULL or name of file to redirect stdout of (last) command to
+///             @a argv and @a outfile point into the parser arena. They remain valid until the
+///             next call to parseline() and must not be freed.
 /// @retval 0 parse successful, execute commands in foreground
 /// @retval 1 parse successful, execute commands in background
 /// @retval -1 invalid command line @a cmdline
@@ -559,12 +676,30 @@ int parseline(const char *cmdline, char ****argv , char **outfile)
                  // 4: end of input (only newline allowed)
 
   *outfile = NULL;
-  char ***cmd = NULL;
-  int cmd_idx = 0, cmd_max = 0;   // current & maximum index into argv
-  int arg_idx = 0, arg_max = 0;   // current & maximum index into argv[cmd_idx]
+  *argv = NULL;
+
+  // carve the command array, the argv arrays, and the copy of the command line from the arena
+  size_t len = strcspn(cmdline, "\n");
+  size_t nptr = len + 2;
+  size_t size = 2*nptr*sizeof(char*) + len + 1;
+
+  if (size > linearena.size) {
+    void *buf = realloc(linearena.buf, size);
+    if (buf == NULL) return parseline_error(cmdline, pos, 6);
+    linearena.buf = buf;
+    linearena.size = size;
+  }
+
+  char ***cmd = linearena.buf;                // command array
+  char **arg = (char**)&cmd[nptr];            // argv arrays, one after the other
+  char *copy = (char*)&arg[nptr];             // command line, tokens are NUL-terminated in place
+  int cmd_idx = 0, arg_idx = 0;               // next free slot in cmd and arg
 
+  memcpy(copy, cmdline, len);
+  copy[len] = '\0';
 
-  while (cmdline[pos] != '\n') {
+
+  while (pos < len) {
     // skip whitespace
     pos = skip_whitespace(cmdline, pos);
 
@@ -575,7 +710,7 @@ int parseline(const char *cmdline, char ****argv , char **outfile)
           //
           if (mode != 1) return parseline_error(cmdline, pos, mode);
           pos++;
-          cmd_idx++; arg_idx = 0; arg_max = 0;
+          arg[arg_idx++] = NULL;              // terminate argv of the current command
           mode = 0;
           break;
         }
@@ -602,6 +737,7 @@ int parseline(const char *cmdline, char ****argv , char **outfile)
         }
 
       case '\n':
+      case '\0':
         { //
           // end of input
           //
@@ -616,46 +752,32 @@ int parseline(const char *cmdline, char ****argv , char **outfile)
           if (mode >= 3) return parseline_error(cmdline, pos, mode);
 
           // check for quoted arguments
-          char extra = NONE;
+          char quote = NONE;
           if ((cmdline[pos] == '\'') || (cmdline[pos] == '"')) {
-            extra = cmdline[pos];
+            quote = cmdline[pos];
             pos++;
           }
 
-          // find end of argument
+          // find end of argument: the closing quote, or a delimiter (' ', '\t', '|', '>')
           int astart = pos;
-          while ((cmdline[pos] != '\n') && (!isdelim(cmdline[pos], extra))) pos++;
+          const char *end = quote != NONE ? memchr(&cmdline[pos], quote, len-pos)
+                                          : strpbrk(&cmdline[pos], " \t|>\n");
+          pos = ((end != NULL) && (end < &cmdline[len])) ? end - cmdline : (int)len;
           int aend = pos;
 
-          if (extra != NONE) {
-            if (cmdline[pos] == extra) pos++;                // include closing quote
+          if (quote != NONE) {
+            if (cmdline[pos] == quote) pos++;                  // include closing quote
             else return parseline_error(cmdline, astart, 5); // no matching end quote found
           }
 
           // extract argument
-          char *argument = malloc(aend-astart+1);
-          strncpy(argument, &cmdline[astart], aend-astart);
-          argument[aend-astart] = '\0';
+          char *argument = &copy[astart];
+          copy[aend] = '\0';
 
           if (mode < 2) {
             // command/argument
-
-            if (cmd_idx >= cmd_max-1) {
-              // resize argv
-              cmd_max += 8;
-              cmd = realloc(cmd, cmd_max * sizeof(cmd[0]));
-              if (cmd == NULL) return parseline_error(cmdline, pos, 6);
-              for (int i=cmd_idx; i<cmd_max; i++) cmd[i] = NULL;
-            }
-            if (arg_idx >= arg_max-1) {
-              // resize argv[cmd_idx]
-              arg_max += 8;
-              cmd[cmd_idx] = realloc(cmd[cmd_idx], arg_max * sizeof(cmd[0][0]));
-              if (cmd[cmd_idx] == NULL) return parseline_error(cmdline, pos, 6);
-              for (int i=arg_idx; i<arg_max; i++) cmd[cmd_idx][i] = NULL;
-            }
-
-            cmd[cmd_idx][arg_idx++] = argument;
+            if (mode == 0) cmd[cmd_idx++] = &arg[arg_idx];
+            arg[arg_idx++] = argument;
 
             if (mode == 0) mode = 1;
           } else {
@@ -666,9 +788,13 @@ int parseline(const char *cmdline, char ****argv , char **outfile)
         }
     }
   }
-  if ((cmd != NULL) && ((mode == 0) || (mode == 2))) return parseline_error(cmdline, pos, mode);
+  if ((cmd_idx > 0) && ((mode == 0) || (mode == 2))) return parseline_error(cmdline, pos, mode);
 
-  *argv = cmd;
+  if (cmd_idx > 0) {
+    arg[arg_idx] = NULL;
+    cmd[cmd_idx] = NULL;
+    *argv = cmd;
+  }
   return bgnd;
 }
 
@@ -677,96 +803,175 @@ int parseline(const char *cmdline, char ****argv , char **outfile)
 // Job list manipulation functions
 //
 
-/// @brief Clear a job struct
-/// @param job job struct
-void clearjob(Job *job)
+/// @brief Hash bucket of key @a key in job table @a jobs
+#define JOBHASH(jobs, key)  ((unsigned int)(key) & ((jobs)->nbuckets - 1))
+
+/// @brief Free the deleted jobs of the job list. Must be called with SIGCHLD blocked.
+/// @param jobs job list
+void freejobs(JobTable *jobs)
 {
-  job->pid = 0;
-  job->jid = 0;
-  job->state = UNDEF;
-  job->cmdline[0] = '\0';
+  while (jobs->dead != NULL) {
+    Job *job = jobs->dead;
+    jobs->dead = job->next;
+    free(job->cmdline);
+    free(job);
+  }
+}
+
+/// @brief Allocate @a nbuckets hash buckets and rehash all jobs into them
+/// @param jobs job list
+/// @param nbuckets number of buckets (power of two)
+/// @retval 1 on success
+/// @retval 0 if out of memory (the job list is unchanged)
+static int rehashjobs(JobTable *jobs, unsigned int nbuckets)
+{
+  Job **pidtab = calloc(nbuckets, sizeof(Job*));
+  Job **jidtab = calloc(nbuckets, sizeof(Job*));
+
+  if ((pidtab == NULL) || (jidtab == NULL)) {
+    free(pidtab);
+    free(jidtab);
+    return 0;
+  }
+
+  free(jobs->pidtab);
+  free(jobs->jidtab);
+  jobs->pidtab = pidtab;
+  jobs->jidtab = jidtab;
+  jobs->nbuckets = nbuckets;
+
+  for (Job *job = jobs->first; job != NULL; job = job->next) {
+    unsigned int p = JOBHASH(jobs, job->pid), j = JOBHASH(jobs, job->jid);
+    job->pnext = pidtab[p]; pidtab[p] = job;
+    job->jnext = jidtab[j]; jidtab[j] = job;
+  }
+
+  return 1;
 }
 
 /// @brief Initialize the job list
 /// @param jobs job list
-void initjobs(Job *jobs)
+void initjobs(JobTable *jobs)
 {
-  for (int i = 0; i < MAXJOBS; i++)
-    clearjob(&jobs[i]);
+  memset(jobs, 0, sizeof(*jobs));
+  if (!rehashjobs(jobs, JOBTAB_INIT)) app_error("initjobs: out of memory");
 }
 
 /// @brief Returns largest allocated job ID
 /// @param jobs job list
 /// @retval int largest allocated job ID
-int maxjid(Job *jobs)
+int maxjid(JobTable *jobs)
 {
-  int max = 0;
-
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].jid > max) max = jobs[i].jid;
-  }
-
-  return max;
+  return jobs->last != NULL ? jobs->last->jid : 0;
 }
 
-/// @brief Add a job to the job list
+/// @brief Add a job to the job list. Must be called with SIGCHLD blocked.
 /// @param jobs job list
 /// @param pid process ID
 /// @param state job state
 /// @param cmdline command line
 /// @retval 1 on success
 /// @retval 0 on failure
-int addjob(Job *jobs, pid_t pid, int state, char *cmdline)
+int addjob(JobTable *jobs, pid_t pid, int state, char *cmdline)
 {
   if (pid < 1) return 0;
 
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == 0) {
-      jobs[i].pid = pid;
-      jobs[i].state = state;
-      jobs[i].jid = nextjid++;
-      if (nextjid > MAXJOBS) nextjid = 1;
-      strncpy(jobs[i].cmdline, cmdline, MAXLINE-1);
-      jobs[i].cmdline[MAXLINE-1] = '\0';
-      VERBOSE("Added job [%d] %d %s", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-      return 1;
-    }
+  freejobs(jobs);
+
+  // 1. grow the hash tables when the load factor would exceed 1
+  if ((jobs->njobs >= jobs->nbuckets) && !rehashjobs(jobs, 2*jobs->nbuckets)) {
+    printf("addjob: out of memory\n");
+    return 0;
   }
 
-  printf("Maximum number of jobs exceeded. Increase MAXJOBS and recompile shell.\n");
-  return 0;
+  // 2. allocate the job
+  Job *job = malloc(sizeof(Job));
+  if ((job == NULL) || ((job->cmdline = strdup(cmdline)) == NULL)) {
+    free(job);
+    printf("addjob: out of memory\n");
+    return 0;
+  }
+
+  job->pid = pid;
+  job->jid = nextjid++;
+  job->state = UNDEF;
+
+  // 3. link it into the hash tables and at the end of the job ID-ordered list
+  unsigned int p = JOBHASH(jobs, pid), j = JOBHASH(jobs, job->jid);
+  job->pnext = jobs->pidtab[p]; jobs->pidtab[p] = job;
+  job->jnext = jobs->jidtab[j]; jobs->jidtab[j] = job;
+
+  job->prev = jobs->last;
+  job->next = NULL;
+  if (jobs->last != NULL) jobs->last->next = job;
+  else jobs->first = job;
+  jobs->last = job;
+  jobs->njobs++;
+
+  setjobstate(jobs, job, state);
+  VERBOSE("Added job [%d] %d %s", job->jid, job->pid, job->cmdline);
+  return 1;
 }
 
-/// @brief Delete job with PID @a pid from the job list
+/// @brief Delete job with PID @a pid from the job list. Async-signal-safe: the job is unlinked
+///        and moved to the list of dead jobs, but not freed.
 /// @param jobs job list
 /// @param pid process ID
 /// @retval 1 on success
 /// @retval 0 on failure
-int deletejob(Job *jobs, pid_t pid)
+int deletejob(JobTable *jobs, pid_t pid)
 {
   if (pid < 1) return 0;
 
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == pid) {
-      clearjob(&jobs[i]);
-      nextjid = maxjid(jobs)+1;
-      return 1;
-    }
-  }
-  return 0;
+  // 1. unlink from the PID hash table
+  Job **pp = &jobs->pidtab[JOBHASH(jobs, pid)];
+  while ((*pp != NULL) && ((*pp)->pid != pid)) pp = &(*pp)->pnext;
+  if (*pp == NULL) return 0;
+
+  Job *job = *pp;
+  *pp = job->pnext;
+
+  // 2. unlink from the job ID hash table
+  pp = &jobs->jidtab[JOBHASH(jobs, job->jid)];
+  while (*pp != job) pp = &(*pp)->jnext;
+  *pp = job->jnext;
+
+  // 3. unlink from the job ID-ordered list
+  if (job->prev != NULL) job->prev->next = job->next;
+  else jobs->first = job->next;
+  if (job->next != NULL) job->next->prev = job->prev;
+  else jobs->last = job->prev;
+  jobs->njobs--;
+
+  setjobstate(jobs, job, UNDEF);
+  nextjid = maxjid(jobs)+1;
+
+  job->next = jobs->dead;
+  jobs->dead = job;
+  return 1;
+}
+
+/// @brief Change the state of job @a job and keep track of the foreground job
+/// @param jobs job list
+/// @param job job
+/// @param state new job state
+void setjobstate(JobTable *jobs, Job *job, int state)
+{
+  if (state == FG) jobs->fg = job;
+  else if (jobs->fg == job) jobs->fg = NULL;
+
+  job->state = state;
 }
 
 /// @brief Return PID of current foreground job, 0 if no such job
 /// @param jobs job list
-/// @retval job_t* pointer to job struct
-/// @retval NULL if no such job exists
-pid_t fgpid(Job *jobs)
+/// @retval pid_t PID of the foreground job
+/// @retval 0 if there is no foreground job
+pid_t fgpid(JobTable *jobs)
 {
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].state == FG) return jobs[i].pid;
-  }
+  Job *job = jobs->fg;
 
-  return 0;
+  return job != NULL ? job->pid : 0;
 }
 
 /// @brief Find a job by a process ID
@@ -774,15 +979,14 @@ pid_t fgpid(Job *jobs)
 /// @param jid process ID
 /// @retval job_t* pointer to job struct
 /// @retval NULL if no such job exists
-Job* getjobpid(Job *jobs, pid_t pid)
+Job* getjobpid(JobTable *jobs, pid_t pid)
 {
   if (pid < 1) return NULL;
 
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == pid) return &jobs[i];
-  }
+  Job *job = jobs->pidtab[JOBHASH(jobs, pid)];
+  while ((job != NULL) && (job->pid != pid)) job = job->pnext;
 
-  return NULL;
+  return job;
 }
 
 /// @brief Find a job by its job ID
@@ -790,15 +994,14 @@ Job* getjobpid(Job *jobs, pid_t pid)
 /// @param jid job ID
 /// @retval job_t* pointer to job struct
 /// @retval NULL if no such job exists
-Job* getjobjid(Job *jobs, int jid)
+Job* getjobjid(JobTable *jobs, int jid)
 {
   if (jid < 1) return NULL;
 
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].jid == jid) return &jobs[i];
-  }
+  Job *job = jobs->jidtab[JOBHASH(jobs, jid)];
+  while ((job != NULL) && (job->jid != jid)) job = job->jnext;
 
-  return NULL;
+  return job;
 }
 
 /// @brief Map process ID to job ID
@@ -807,33 +1010,354 @@ Job* getjobjid(Job *jobs, int jid)
 /// @retval 0 if no such job exists
 int pid2jid(pid_t pid)
 {
-  if (pid < 1) return 0;
+  Job *job = getjobpid(&jobs, pid);
 
-  for (int i=0; i<MAXJOBS; i++) {
-    if (jobs[i].pid == pid) return jobs[i].jid;
-  }
-
-  return 0;
+  return job != NULL ? job->jid : 0;
 }
 
 /// @brief Print job list
 /// @param jobs job list
-void listjobs(Job *jobs)
+void listjobs(JobTable *jobs)
+{
+  for (Job *job = jobs->first; job != NULL; job = job->next) {
+    printf("[%d] (%d) ", job->jid, emit_prompt ? job->pid : -1);
+
+    switch (job->state) {
+      case BG: printf("Running ");    break;
+      case FG: printf("Foreground "); break;
+      case ST: printf("Stopped ");    break;
+      default: printf("listjobs: Internal error: job[%d].state=%d ", job->jid, job->state);
+    }
+
+    printf("%s", job->cmdline); // cmdline includes a newline
+  }
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Command launch
+//
+// Commands are started with posix_spawn() which, unlike fork(), does not copy the shell's page
+// tables (glibc clones the shell with vfork semantics). Redirection of stdin/stdout and the
+// process group and signal mask of the child are passed as spawn file actions and attributes.
+//
+// Command names without a slash are searched in PATH once and then remembered in a hash table,
+// similar to the 'hash' built-in of other shells. The cache is flushed when PATH changes, and an
+// entry is dropped if its executable has disappeared.
+//
+
+/// @brief Hash bucket of command name @a name
+static unsigned int pathhash(const char *name)
 {
-  for (int i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid != 0) {
-      printf("[%d] (%d) ", jobs[i].jid, emit_prompt ? jobs[i].pid : -1);
+  unsigned int h = 2166136261u;               // FNV-1a
+
+  while (*name != '\0') h = (h ^ (unsigned char)*name++) * 16777619u;
+
+  return h % PATHTAB_SIZE;
+}
+
+/// @brief Search command @a name in the directories of @a path
+/// @param name command name
+/// @param path colon-separated list of directories (empty entries denote the current directory)
+/// @retval char* heap-allocated full path of the executable
+/// @retval NULL if no executable was found
+static char* pathsearch(const char *name, const char *path)
+{
+  char buf[PATH_MAX];
+  size_t nlen = strlen(name);
+  struct stat st;
+
+  while (1) {
+    const char *end = strchrnul(path, ':');
+    size_t dlen = end - path;
 
-      switch (jobs[i].state) {
-        case BG: printf("Running ");    break;
-        case FG: printf("Foreground "); break;
-        case ST: printf("Stopped ");    break;
-        default: printf("listjobs: Internal error: job[%d].state=%d ", i, jobs[i].state);
+    if (dlen + nlen + 2 <= sizeof(buf)) {
+      if (dlen == 0) buf[dlen++] = '.';
+      else memcpy(buf, path, dlen);
+      buf[dlen] = '/';
+      memcpy(&buf[dlen+1], name, nlen+1);
+
+      if ((access(buf, X_OK) == 0) && (stat(buf, &st) == 0) && S_ISREG(st.st_mode)) {
+        return strdup(buf);
       }
+    }
 
-      printf("%s", jobs[i].cmdline); // cmdline includes a newline
+    if (*end == '\0') return NULL;
+    path = end + 1;
+  }
+}
+
+/// @brief Flush the command path cache
+void pathflush(void)
+{
+  for (int i = 0; i < PATHTAB_SIZE; i++) {
+    while (pathtab[i] != NULL) {
+      PathEnt *e = pathtab[i];
+      pathtab[i] = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
     }
   }
+
+  free(pathtab_path);
+  pathtab_path = NULL;
+}
+
+/// @brief Resolve command @a name to an executable. Names containing a slash are used as is, all
+///        others are looked up in the command path cache and searched in PATH on a miss.
+/// @param name command name
+/// @retval char* path of the executable (owned by the cache or @a name itself)
+/// @retval NULL if the command was not found in PATH
+char* pathlookup(const char *name)
+{
+  if (strchr(name, '/') != NULL) return (char*)name;
+
+  // 1. flush the cache if PATH has changed since it was filled
+  const char *path = getenv("PATH");
+  if (path == NULL) path = DEFPATH;
+
+  if ((pathtab_path == NULL) || strcmp(path, pathtab_path)) {
+    pathflush();
+    if ((pathtab_path = strdup(path)) == NULL) unix_error("pathlookup");
+  }
+
+  // 2. cache hit
+  unsigned int h = pathhash(name);
+  for (PathEnt *e = pathtab[h]; e != NULL; e = e->next) {
+    if (!strcmp(e->name, name)) return e->path;
+  }
+
+  // 3. search PATH and remember the result. Misses are not cached, so that commands installed
+  //    later are found.
+  char *exe = pathsearch(name, path);
+  if (exe == NULL) return NULL;
+
+  PathEnt *e = malloc(sizeof(PathEnt));
+  if ((e == NULL) || ((e->name = strdup(name)) == NULL)) unix_error("pathlookup");
+  e->path = exe;
+  e->next = pathtab[h];
+  pathtab[h] = e;
+
+  return exe;
+}
+
+/// @brief Remove command @a name from the command path cache
+/// @param name command name
+void pathforget(const char *name)
+{
+  PathEnt **pe = &pathtab[pathhash(name)];
+
+  while ((*pe != NULL) && strcmp((*pe)->name, name)) pe = &(*pe)->next;
+
+  if (*pe != NULL) {
+    PathEnt *e = *pe;
+    *pe = e->next;
+    free(e->name);
+    free(e->path);
+    free(e);
+  }
+}
+
+/// @brief Spawn command @a argv in a new process group. The child's stdin and stdout are
+///        connected to @a in and @a out; all other descriptors of the shell that are not marked
+///        close-on-exec are inherited.
+/// @param argv command and arguments
+/// @param in file descriptor to use as stdin
+/// @param out file descriptor to use as stdout
+/// @param mask signal mask of the child
+/// @param[out] pid PID of the child
+/// @retval 0 on success
+/// @retval errno error code if the command could not be started
+int spawncmd(char *argv[], int in, int out, const sigset_t *mask, pid_t *pid)
+{
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  int res;
+
+  // 1. child runs in its own process group with the given signal mask
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setsigmask(&attr, mask);
+
+  // 2. redirect stdin/stdout
+  posix_spawn_file_actions_init(&fa);
+  if (in != STDIN_FILENO) posix_spawn_file_actions_adddup2(&fa, in, STDIN_FILENO);
+  if (out != STDOUT_FILENO) posix_spawn_file_actions_adddup2(&fa, out, STDOUT_FILENO);
+
+  // 3. spawn. If a cached executable has vanished, forget it and search PATH once more.
+  for (int retry = 0; ; retry++) {
+    char *exe = pathlookup(argv[0]);
+    if (exe == NULL) { res = ENOENT; break; }
+
+    res = posix_spawn(pid, exe, &fa, &attr, argv, environ);
+    if ((res != ENOENT) || (exe == argv[0]) || retry) break;
+
+    pathforget(argv[0]);
+  }
+
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&attr);
+
+  return res;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Batch mode and timing
+//
+// With -f <script>, the shell reads its commands from a script through a buffered reader instead
+// of interacting with stdin, and no prompt is printed. Empty lines, comments, and the directives
+// of the driver (SLEEP, TSTP, INT, ...) are skipped, so the trace files can be run directly; jobs that the
+// driver would stop or interrupt run to completion.
+//
+// With -t, a timing report is printed after every command line:
+//   parse    time spent in parseline()
+//   spawn    time to launch all processes of the job
+//   wall     wall time of the command line, including the wait for a foreground job
+//   user/sys CPU time of the children reaped while the command line executed (obtained with
+//            wait4() in the SIGCHLD handler). Background jobs are accounted to the command line
+//            during which they terminate.
+// followed by the totals when the shell exits.
+//
+
+/// @brief Current time of the monotonic clock in nanoseconds
+uint64_t nsec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/// @brief Read the next line from reader @a r. Like fgets(), at most @a size-1 characters are read
+///        and the newline is retained.
+/// @param r reader
+/// @param line buffer for the line
+/// @param size size of @a line
+/// @retval ssize_t length of the line
+/// @retval 0 at end of file
+/// @retval -1 on error (errno is set)
+ssize_t readline(Reader *r, char *line, size_t size)
+{
+  size_t n = 0;
+
+  while (n < size - 1) {
+    // 1. refill the buffer
+    if (r->pos == r->len) {
+      ssize_t res = read(r->fd, r->buf, sizeof(r->buf));
+      if (res < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      if (res == 0) break;
+      r->pos = 0;
+      r->len = res;
+    }
+
+    // 2. copy up to and including the next newline
+    size_t cnt = r->len - r->pos;
+    if (cnt > size - 1 - n) cnt = size - 1 - n;
+
+    char *nl = memchr(&r->buf[r->pos], '\n', cnt);
+    if (nl != NULL) cnt = nl - &r->buf[r->pos] + 1;
+
+    memcpy(&line[n], &r->buf[r->pos], cnt);
+    r->pos += cnt;
+    n += cnt;
+
+    if (nl != NULL) break;
+  }
+
+  line[n] = '\0';
+  return n;
+}
+
+/// @brief Check whether @a cmdline is empty, a comment, or a driver directive
+/// @param cmdline command line
+/// @retval 1 if the line is to be skipped in batch mode
+/// @retval 0 otherwise
+int isdirective(const char *cmdline)
+{
+  static const char *directive[] = { "SLEEP", "TSTP", "INT", "QUIT", "KILL", "WAIT", "CLOSE",
+                                     "NEXT", NULL };
+
+  cmdline += strspn(cmdline, " \t");
+  if ((*cmdline == '#') || (*cmdline == '\n') || (*cmdline == '\0')) return 1;
+
+  size_t len = strcspn(cmdline, " \t\n");
+  for (int i = 0; directive[i] != NULL; i++) {
+    if ((strlen(directive[i]) == len) && !strncmp(cmdline, directive[i], len)) {
+      VERBOSE("Skipping directive %.*s", (int)len, cmdline);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/// @brief Print timing @a t
+/// @param t timing
+/// @param label label printed after the timing
+/// @param len length of @a label
+static void printtiming(const Timing *t, const char *label, int len)
+{
+  fprintf(stderr, "[time] parse %8.1fus  spawn %8.1fus  wall %10.3fms  "
+                  "user %7.3fs  sys %7.3fs  %.*s\n",
+          t->parse/1e3, t->spawn/1e3, t->wall/1e6,
+          t->utime.tv_sec + t->utime.tv_usec/1e6, t->stime.tv_sec + t->stime.tv_usec/1e6,
+          len, label);
+}
+
+/// @brief Evaluate the command line and print its timing report
+/// @param cmdline command line
+void evaltimed(char *cmdline)
+{
+  sigset_t mask, prev;
+  struct timeval utime, stime;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+
+  // 1. snapshot the CPU time of the reaped children
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  utime = child_utime;
+  stime = child_stime;
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+
+  // 2. evaluate
+  memset(&cmdtime, 0, sizeof(cmdtime));
+  uint64_t start = nsec();
+  eval(cmdline);
+  cmdtime.wall = nsec() - start;
+
+  sigprocmask(SIG_BLOCK, &mask, &prev);
+  timersub(&child_utime, &utime, &cmdtime.utime);
+  timersub(&child_stime, &stime, &cmdtime.stime);
+  sigprocmask(SIG_SETMASK, &prev, NULL);
+
+  // 3. report and accumulate
+  fflush(stdout);
+  printtiming(&cmdtime, cmdline, strcspn(cmdline, "\n"));
+
+  totaltime.parse += cmdtime.parse;
+  totaltime.spawn += cmdtime.spawn;
+  totaltime.wall += cmdtime.wall;
+  timeradd(&totaltime.utime, &cmdtime.utime, &totaltime.utime);
+  timeradd(&totaltime.stime, &cmdtime.stime, &totaltime.stime);
+  ncmds++;
+}
+
+/// @brief Print the accumulated timing of all command lines. Registered with atexit().
+void timingsummary(void)
+{
+  char label[64];
+
+  int len = snprintf(label, sizeof(label), "total (%lu commands)", ncmds);
+
+  fflush(stdout);
+  printtiming(&totaltime, label, len);
 }
 
 
@@ -845,10 +1369,12 @@ void listjobs(Job *jobs)
 __attribute__((noreturn))
 void usage(const char *program)
 {
-  printf("Usage: %s [-hvp]\n", basename(program));
+  printf("Usage: %s [-hvpt] [-f <script>]\n", basename(program));
   printf("   -h   print this message\n");
   printf("   -v   print additional diagnostic information\n");
   printf("   -p   do not emit a command prompt\n");
+  printf("   -f   execute commands from <script> (batch mode, no prompt)\n");
+  printf("   -t   print a timing report for every command\n");
   exit(EXIT_FAILURE);
 }
 
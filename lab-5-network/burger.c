@@ -31,12 +31,33 @@
 /// DAMAGE.
 //--------------------------------------------------------------------------------------------------
 
+#include <string.h>
+
 #include "burger.h"
 
 char *burger_names[] = {
-  "bigmac",
-  "cheese",
-  "chicken",
-  "bulgogi"
+#define BURGER_NAME(e, name) #name,
+  BURGER_LIST(BURGER_NAME)
+#undef BURGER_NAME
+};
+
+const size_t burger_name_len[] = {
+#define BURGER_LEN(e, name) sizeof(#name) - 1,
+  BURGER_LIST(BURGER_LEN)
+#undef BURGER_LEN
 };
 
+enum burger_type burger_lookup(const char *name, size_t len)
+{
+  if (len == 0) return BURGER_TYPE_MAX;
+
+  // dispatch on length and first character, both compile-time constants for every burger; only
+  // a candidate is compared in full
+#define BURGER_MATCH(e, n) \
+  if ((len == sizeof(#n) - 1) && (name[0] == #n[0]) && !memcmp(name, #n, len)) return e;
+  BURGER_LIST(BURGER_MATCH)
+#undef BURGER_MATCH
+
+  return BURGER_TYPE_MAX;
+}
+
@@ -31,6 +31,8 @@
 /// DAMAGE.
 //--------------------------------------------------------------------------------------------------
 
+#include <stddef.h>
+
 /// @name Macro definitions
 /// @{
 
@@ -40,14 +42,28 @@
 
 /// @}
 
+/// @brief served burgers, X(enumerator, name). enum burger_type, burger_names[], and
+///        burger_lookup() are generated from this list.
+#define BURGER_LIST(X) \
+  X(BURGER_BIGMAC,  bigmac)  \
+  X(BURGER_CHEESE,  cheese)  \
+  X(BURGER_CHICKEN, chicken) \
+  X(BURGER_BULGOGI, bulgogi)
+
 /// @brief served burger types
 enum burger_type {
-  BURGER_BIGMAC,
-  BURGER_CHEESE,
-  BURGER_CHICKEN,
-  BURGER_BULGOGI,
+#define BURGER_ENUM(e, name) e,
+  BURGER_LIST(BURGER_ENUM)
+#undef BURGER_ENUM
   BURGER_TYPE_MAX
 };
 
 extern char *burger_names[];                                ///< burger names as strings
+extern const size_t burger_name_len[];                      ///< strlen(burger_names[])
+
+/// @brief look up the burger named by the @a len bytes at @a name (not '\0'-terminated)
+/// @param name burger name
+/// @param len length of @a name
+/// @retval burger type, or BURGER_TYPE_MAX if there is no such burger
+enum burger_type burger_lookup(const char *name, size_t len);
 
@@ -2,7 +2,7 @@
 // System Programming                       Network Lab                                  Fall 2021
 //
 /// @file
-/// @brief Client-side implementation of Network Lab
+/// @brief Client-side implementation of Network Lab: load generator for the McDonald's server
 ///
 /// @author <Park YeongSeo>
 /// @studid <2016-13006>
@@ -10,6 +10,7 @@
 /// @section changelog Change Log
 /// 2020/11/18 Hyunik Kim created
 /// 2021/11/23 Jaume Mateu Cuadrat cleanup, add milestones
+/// 2021/12/15 Park YeongSeo load generator: closed/open loop, burger mix, reuse, latency histogram
 ///
 /// @section license_section License
 /// Copyright (c) 2020-2021, Computer Systems and Platforms Laboratory, SNU
@@ -39,11 +40,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <errno.h>
 #include <time.h>
 
 #include <sys/socket.h>
+#include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -52,104 +56,554 @@
 #include "burger.h"
 
 
-/// @brief client task for connection thread
-void *thread_task(void *data)
+// Load generator
+// ==============
+// Every connection is driven by its own thread. In closed-loop mode (default), a thread issues
+// its next order as soon as the previous one has been served. In open-loop mode (-r <rate>),
+// orders are issued on a fixed schedule, independent of the server's response time, and the
+// latency of an order is measured from its scheduled start, so a stalled server cannot hide its
+// tail latency by slowing down the client ("coordinated omission").
+//
+// Latencies are recorded in an HDR-style log-linear histogram: values below 2^HIST_SUB_BITS
+// microseconds are exact, larger values fall into one of 2^HIST_SUB_BITS buckets per power of
+// two, i.e., the relative error is below 2^-HIST_SUB_BITS.
+//
+// With -k, a connection carries all orders of its thread using the keep-alive protocol: orders
+// are sent as "#<id> <burger>" lines, up to -P orders back to back without waiting for the
+// replies, which the server tags with the id of the order.
+//
+
+
+/// @name Macro definitions
+/// @{
+
+#define HIST_SUB_BITS 5                                     ///< log2(buckets per power of two)
+#define HIST_SUB (1 << HIST_SUB_BITS)                       ///< buckets per power of two
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS) * HIST_SUB)      ///< buckets covering uint64_t
+#define MAX_DEPTH 64                                        ///< maximum pipeline depth
+
+/// @}
+
+/// @name Structures
+/// @{
+
+/// @brief log-linear latency histogram (values in microseconds)
+typedef struct {
+  uint64_t count[HIST_BUCKETS];                             ///< number of values per bucket
+  uint64_t total;                                           ///< number of values
+  uint64_t sum;                                             ///< sum of all values
+  uint64_t min, max;                                        ///< smallest and largest value
+} Histogram;
+
+/// @brief state and results of one connection thread
+typedef struct {
+  pthread_t tid;                                            ///< thread
+  int id;                                                   ///< thread index
+  unsigned int seed;                                        ///< rand_r() state
+  Histogram hist;                                           ///< latencies of served orders
+  unsigned long errors;                                     ///< failed orders
+  unsigned long connects;                                   ///< connections opened
+  unsigned long rejected;                                   ///< connections turned away (busy)
+} Worker;
+
+/// @brief order in flight on a keep-alive connection
+typedef struct {
+  unsigned long tag;                                        ///< order id
+  struct timespec due;                                      ///< start of the order
+} Pending;
+
+/// @}
+
+/// @name Global variables
+/// @{
+
+const char *server = IP;                                    ///< server host name or address
+unsigned short port = PORT;                                 ///< server port
+int num_conns = 1;                                          ///< number of connections (threads)
+long num_orders = 0;                                        ///< orders per connection (0: -d)
+double duration = 0;                                        ///< run time in seconds (0: -n)
+double rate = 0;                                            ///< total orders per second (0: closed)
+bool keepalive = false;                                     ///< reuse connections for orders
+int depth = 1;                                              ///< orders in flight per connection
+bool verbose = false;                                       ///< print the conversation
+unsigned int mix[BURGER_TYPE_MAX];                          ///< relative weight of each burger
+unsigned int mix_total = 0;                                 ///< sum of mix[]
+struct timespec start_time;                                 ///< common start of all threads
+
+/// @}
+
+
+/// @brief elapsed time between @a a and @a b in nanoseconds
+int64_t elapsed_ns(const struct timespec *a, const struct timespec *b)
 {
-  struct addrinfo *ai, *ai_it;
-  size_t read, sent, buflen;
-  int serverfd = -1, choice, ret;
-  char *buffer;
-  pthread_t tid;
+  return (int64_t)(b->tv_sec - a->tv_sec)*1000000000L + b->tv_nsec - a->tv_nsec;
+}
+
+/// @brief advance @a ts by @a ns nanoseconds
+void add_ns(struct timespec *ts, int64_t ns)
+{
+  ts->tv_sec += ns / 1000000000L;
+  ts->tv_nsec += ns % 1000000000L;
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+/// @brief histogram bucket of @a v
+unsigned int hist_bucket(uint64_t v)
+{
+  if (v < HIST_SUB) return v;
+
+  int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (unsigned int)(v >> shift) - HIST_SUB;
+}
+
+/// @brief largest value that falls into bucket @a b
+uint64_t hist_value(unsigned int b)
+{
+  if (b < HIST_SUB) return b;
+
+  int shift = b / HIST_SUB - 1;
+  return (((uint64_t)(HIST_SUB + b % HIST_SUB) + 1) << shift) - 1;
+}
 
-  tid = pthread_self();
+/// @brief record value @a v in histogram @a h
+void hist_record(Histogram *h, uint64_t v)
+{
+  h->count[hist_bucket(v)]++;
+  if ((h->total == 0) || (v < h->min)) h->min = v;
+  if (v > h->max) h->max = v;
+  h->total++;
+  h->sum += v;
+}
 
-  buffer = (char *)malloc(BUF_SIZE);
-  buflen = BUF_SIZE;
+/// @brief add histogram @a src to @a dst
+void hist_merge(Histogram *dst, const Histogram *src)
+{
+  if (src->total == 0) return;
 
-  // Connect to McDonald's server
-  // Get the socket list
+  for (unsigned int b = 0; b < HIST_BUCKETS; b++) dst->count[b] += src->count[b];
+  if ((dst->total == 0) || (src->min < dst->min)) dst->min = src->min;
+  if (src->max > dst->max) dst->max = src->max;
+  dst->total += src->total;
+  dst->sum += src->sum;
+}
 
-  ai = getsocklist(IP, PORT, AF_UNSPEC, SOCK_STREAM, 0, &ret);
-  if (ret) {
-	printf("%s\n",gai_strerror(ret));
-	goto err;
+/// @brief value at percentile @a p (0..100) of histogram @a h
+uint64_t hist_percentile(const Histogram *h, double p)
+{
+  uint64_t rank = (uint64_t)(p / 100.0 * h->total + 0.5), seen = 0;
+
+  if (rank < 1) rank = 1;
+  for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->count[b];
+    if (seen >= rank) return hist_value(b) < h->max ? hist_value(b) : h->max;
   }
-  
 
-  // Create the sockets and connect
-  ai_it = ai;
-  while (ai_it != NULL) {
-	serverfd = socket(ai_it->ai_family, ai_it->ai_socktype, ai_it->ai_protocol);
-	if (serverfd != -1) {
-		if (!connect(serverfd, ai_it->ai_addr, ai_it->ai_addrlen)) break; //success;
-		close(serverfd); //failed
-	}
- 	ai_it = ai_it->ai_next; //failed ==> next
+  return h->max;
+}
+
+/// @brief write the percentile distribution of histogram @a h to @a f as CSV
+void hist_csv(const Histogram *h, FILE *f)
+{
+  uint64_t seen = 0;
+
+  fprintf(f, "value_us,percentile,count,total_count\n");
+  for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+    if (h->count[b] == 0) continue;
+    seen += h->count[b];
+    fprintf(f, "%lu,%.6f,%lu,%lu\n", hist_value(b) < h->max ? hist_value(b) : h->max,
+            100.0 * seen / h->total, h->count[b], seen);
   }
+}
 
-  // Read welcome message from the server
-  read = get_line(serverfd, &buffer, &buflen);
-  if (read <= 0) {
-    printf("Cannot read data from server\n");
-    goto err;
+/// @brief pick a burger according to the burger mix
+/// @param seed rand_r() state
+enum burger_type pick_burger(unsigned int *seed)
+{
+  unsigned int r = rand_r(seed) % mix_total;
+  enum burger_type type = BURGER_BIGMAC;
+
+  while (r >= mix[type]) r -= mix[type++];
+
+  return type;
+}
+
+/// @brief connect to the server and receive the welcome message
+/// @param w worker
+/// @param nc buffered connection; its buffer is reused for the new socket
+/// @param[out] retry_ms time the server asks us to wait if it is busy
+/// @retval 0 on success
+/// @retval -1 on failure
+/// @retval -2 if the server is busy
+int open_connection(Worker *w, NetConn *nc, long *retry_ms)
+{
+  struct addrinfo *ai, *ai_it;
+  int serverfd = -1, ret;
+  char *line;
+
+  ai = getsocklist(server, port, AF_UNSPEC, SOCK_STREAM, 0, &ret);
+  if (ai == NULL) {
+    printf("%s\n", gai_strerror(ret));
+    return -1;
   }
 
-  printf("[Thread %lu] From server: %s", tid, buffer);
+  for (ai_it = ai; ai_it != NULL; ai_it = ai_it->ai_next) {
+    serverfd = socket(ai_it->ai_family, ai_it->ai_socktype, ai_it->ai_protocol);
+    if (serverfd != -1) {
+      if (!connect(serverfd, ai_it->ai_addr, ai_it->ai_addrlen)) break; //success;
+      close(serverfd); //failed
+      serverfd = -1;
+    }
+  }
+  freeaddrinfo(ai);
+  if (serverfd == -1) return -1;
 
-  // Randomly choose which burger to order
-  choice = rand() % BURGER_TYPE_MAX;
-  ret = strlen(burger_names[choice]);
-  printf("[Thread %lu] To server: Can I have a %s burger?\n", tid, burger_names[choice]);
+  nc->sock = serverfd;
+  nc->start = nc->end = nc->scan = 0;
+  w->connects++;
 
-  memset(buffer, 0, BUF_SIZE);
-  strncpy(buffer, burger_names[choice], ret);
-  buffer[ret] = '\n';
+  // read welcome message from the server
+  if (nc_get_line(nc, &line) <= 0) {
+    close(serverfd);
+    nc->sock = -1;
+    return -1;
+  }
+  if (verbose) printf("[Thread %lu] From server: %s\n", w->tid, line);
 
-  // Send burger name to the server
-  sent = put_line(serverfd, buffer, strlen(buffer));
-  if (sent < 0) {
-    printf("Error: cannot send data to server\n");
-    goto err;
+  if (sscanf(line, "Busy, retry after %ld ms", retry_ms) == 1) {
+    close(serverfd);
+    nc->sock = -1;
+    w->rejected++;
+    return -2;
   }
 
-  // Get final message from the server
-  memset(buffer, 0, BUF_SIZE);
-  read = get_line(serverfd, &buffer, &buflen);
-  if (read <= 0) {
-    printf("Cannot read data from server\n");
-    goto err;
+  return 0;
+}
+
+/// @brief connect to the server; if the server is busy, wait as long as it asks and try again
+/// @param w worker
+/// @param nc buffered connection
+/// @param end end of the run if duration > 0
+/// @retval 0 on success
+/// @retval -1 on failure or if the run ended while waiting
+int connect_server(Worker *w, NetConn *nc, const struct timespec *end)
+{
+  struct timespec now;
+  long retry_ms;
+  int r;
+
+  while ((r = open_connection(w, nc, &retry_ms)) == -2) {
+    usleep(retry_ms * 1000);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((duration > 0) && (elapsed_ns(end, &now) >= 0)) return -1;
   }
+  if (r < 0) {
+    printf("Error: cannot connect to %s:%d\n", server, port);
+    w->errors++;
+  }
+
+  return r;
+}
+
+/// @brief scheduled start of order @a i of worker @a w in open-loop mode. The threads'
+///        schedules are interleaved so that the whole client issues one order every 1/rate s.
+/// @param w worker
+/// @param i order index
+/// @param[out] due start of the order
+void schedule(const Worker *w, long i, struct timespec *due)
+{
+  *due = start_time;
+  add_ns(due, (int64_t)((w->id + (double)i * num_conns) / rate * 1e9));
+}
+
+/// @brief keep-alive connection thread: pipeline up to depth orders on one connection
+/// @param w worker
+/// @param nc buffered connection
+/// @param end end of the run if duration > 0
+void run_keepalive(Worker *w, NetConn *nc, const struct timespec *end)
+{
+  Pending pending[MAX_DEPTH];
+  struct timespec now, due;
+  char order[BUF_SIZE], *line;
+  int npending = 0, i;
+  long sent = 0;
+  bool more = true;
+
+  if (connect_server(w, nc, end) < 0) return;
+
+  while (more || (npending > 0)) {
+    // 1. send orders while the pipeline has room and the orders are due
+    while (more && (npending < depth)) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (rate > 0) schedule(w, sent, &due);
+      else due = now;
+
+      if (((num_orders > 0) && (sent == num_orders)) ||
+          ((duration > 0) && (elapsed_ns(end, &due) >= 0))) {
+        more = false;
+        break;
+      }
+      if (elapsed_ns(&now, &due) > 0) break;
+
+      enum burger_type type = pick_burger(&w->seed);
+      int len = snprintf(order, sizeof(order), "#%ld %s", sent, burger_names[type]);
+      if (verbose) printf("[Thread %lu] To server: %s\n", w->tid, order);
+      if (put_line(nc->sock, order, len) < 0) goto err;
+
+      pending[npending].tag = sent++;
+      pending[npending++].due = due;
+    }
+    if (!more && (npending == 0)) break;
+
+    // 2. wait for a reply, or until the next order is due
+    if (nc_next_line(nc, &line) == 0) {
+      struct pollfd pfd = { .fd = nc->sock, .events = POLLIN };
+      int timeout = -1;
+
+      if (more && (npending < depth)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timeout = elapsed_ns(&now, &due) / 1000000 + 1;
+      }
+      if (poll(&pfd, 1, timeout) <= 0) continue;
+      if (nc_fill(nc) <= 0) goto err;
+      continue;
+    }
 
-  printf("[Thread %lu] From server: %s", tid, buffer);
+    // 3. match the reply to its order
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (verbose) printf("[Thread %lu] From server: %s\n", w->tid, line);
+
+    unsigned long tag = (line[0] == '#') ? strtoul(line + 1, NULL, 10) : 0;
+    for (i = 0; (i < npending) && (pending[i].tag != tag); i++);
+    if ((line[0] != '#') || (i == npending)) {
+      printf("Error: unexpected reply '%s'\n", line);
+      goto err;
+    }
+
+    if (strstr(line, "ready") != NULL) {
+      hist_record(&w->hist, elapsed_ns(&pending[i].due, &now) / 1000);
+    } else {
+      printf("Error: order failed: %s\n", line);
+      w->errors++;
+    }
+    pending[i] = pending[--npending];
+  }
+
+  close(nc->sock);
+  nc->sock = -1;
+  return;
 
 err:
-  close(serverfd);
-  pthread_exit(NULL);
+  // the orders in flight are lost
+  printf("Error: connection failed\n");
+  w->errors += npending > 0 ? npending : 1;
+  close(nc->sock);
+  nc->sock = -1;
+}
+
+/// @brief connection thread: issue orders until num_orders or duration is reached
+/// @param data Worker
+void *thread_task(void *data)
+{
+  Worker *w = data;
+  struct timespec end, due, now;
+  NetConn nc;
+  char *line;
+  long i;
+
+  w->tid = pthread_self();
+  if (nc_init(&nc, -1, BUF_SIZE, 0) < 0) return NULL;
+
+  end = start_time;
+  add_ns(&end, (int64_t)(duration * 1e9));
+
+  if (keepalive) {
+    run_keepalive(w, &nc, &end);
+    nc_free(&nc);
+    return NULL;
+  }
+
+  for (i = 0; (num_orders == 0) || (i < num_orders); i++) {
+    // 1. determine the start of the order
+    if (rate > 0) {
+      schedule(w, i, &due);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+    } else {
+      clock_gettime(CLOCK_MONOTONIC, &due);
+    }
+    if ((duration > 0) && (elapsed_ns(&end, &due) >= 0)) break;
+
+    // 2. connect. Time spent waiting for a busy server counts towards the latency
+    if (connect_server(w, &nc, &end) < 0) break;
+
+    // 3. order a burger and wait for it
+    enum burger_type type = pick_burger(&w->seed);
+    if (verbose) printf("[Thread %lu] To server: Can I have a %s burger?\n",
+                        w->tid, burger_names[type]);
+
+    if ((put_line(nc.sock, burger_names[type], strlen(burger_names[type])) < 0) ||
+        (nc_get_line(&nc, &line) <= 0) || (strstr(line, "ready") == NULL)) {
+      printf("Error: order failed\n");
+      w->errors++;
+      close(nc.sock);
+      nc.sock = -1;
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hist_record(&w->hist, elapsed_ns(&due, &now) / 1000);
+    if (verbose) printf("[Thread %lu] From server: %s\n", w->tid, line);
+
+    close(nc.sock);
+    nc.sock = -1;
+  }
+
+  nc_free(&nc);
+  return NULL;
+}
+
+/// @brief parse burger mix @a s: a comma-separated list of weights, either by position
+///        ("3,1,0,1") or by name ("bigmac=3,cheese=1")
+/// @retval 0 on success, -1 on syntax error
+int parse_mix(char *s)
+{
+  char *tok, *save;
+  int pos = 0;
+
+  memset(mix, 0, sizeof(mix));
+  for (tok = strtok_r(s, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save), pos++) {
+    char *eq = strchr(tok, '='), *endp;
+    int type = pos;
+
+    if (eq != NULL) {
+      *eq = '\0';
+      for (type = 0; type < BURGER_TYPE_MAX; type++) {
+        if (!strcmp(burger_names[type], tok)) break;
+      }
+      tok = eq + 1;
+    }
+    if (type >= BURGER_TYPE_MAX) return -1;
+
+    long wgt = strtol(tok, &endp, 10);
+    if ((*tok == '\0') || (*endp != '\0') || (wgt < 0)) return -1;
+    mix[type] = wgt;
+  }
+
+  return 0;
+}
+
+/// @brief print usage and exit
+/// @param prog program name
+void usage(const char *prog)
+{
+  printf("usage: %s [options] [<connections>]\n"
+         "  -c <conns>   number of concurrent connections (default: 1)\n"
+         "  -n <orders>  orders per connection (default: 1 unless -d is given)\n"
+         "  -d <sec>     run for <sec> seconds\n"
+         "  -r <rate>    open loop: <rate> orders per second in total (default: closed loop)\n"
+         "  -m <mix>     burger mix, e.g. 3,1,0,1 or bigmac=3,cheese=1 (default: uniform)\n"
+         "  -k           reuse connections for subsequent orders (keep-alive protocol)\n"
+         "  -P <depth>   with -k: orders in flight per connection (default: 1, max: %d)\n"
+         "  -s <server>  server address (default: %s)\n"
+         "  -p <port>    server port (default: %d)\n"
+         "  -o <file>    write the latency distribution to <file> as CSV\n"
+         "  -v           print the conversation with the server\n", prog, MAX_DEPTH, IP, PORT);
+  exit(EXIT_FAILURE);
 }
 
 /// @brief program entry point
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
-  int i;
-  int num_threads;
+  const char *csvfn = NULL;
+  struct timespec stop;
+  Histogram *total;
+  Worker *workers;
+  unsigned long errors = 0, connects = 0, rejected = 0;
+  int i, opt;
+
+  for (i = 0; i < BURGER_TYPE_MAX; i++) mix[i] = 1;
+
+  while ((opt = getopt(argc, argv, "c:n:d:r:m:kP:s:p:o:vh")) != -1) {
+    switch (opt) {
+      case 'c': num_conns = atoi(optarg); break;
+      case 'n': num_orders = atol(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'm': if (parse_mix(optarg) < 0) usage(argv[0]); break;
+      case 'k': keepalive = true; break;
+      case 'P': depth = atoi(optarg); break;
+      case 's': server = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 'o': csvfn = optarg; break;
+      case 'v': verbose = true; break;
+      default:  usage(argv[0]);
+    }
+  }
+  // the number of connections may also be given as the only argument (client <num_threads>)
+  if (optind < argc) num_conns = atoi(argv[optind++]);
+  if ((optind < argc) || (num_conns < 1) || (num_orders < 0) || (duration < 0) || (rate < 0) ||
+      (depth < 1) || (depth > MAX_DEPTH)) {
+    usage(argv[0]);
+  }
+  if ((num_orders == 0) && (duration == 0)) num_orders = 1;
+
+  for (i = 0; i < BURGER_TYPE_MAX; i++) mix_total += mix[i];
+  if (mix_total == 0) usage(argv[0]);
 
-  if (argc != 2) {
-    printf("usage ./client <num_threads>\n");
-    return 0;
+  workers = calloc(num_conns, sizeof(Worker));
+  total = calloc(1, sizeof(Histogram));
+  if ((workers == NULL) || (total == NULL)) {
+    perror("calloc");
+    return EXIT_FAILURE;
   }
 
-  // Create the threads equal to the num of threads passed in the argument
-  num_threads = atoi(argv[1]);	//get the num of threads;
-  pthread_t *ptid = (pthread_t*)malloc(num_threads * sizeof(pthread_t)); //make num_threads threads
-  for (i = 0; i < num_threads; i++) {
-	pthread_create(&ptid[i], NULL, thread_task, NULL); 
+  // Create one thread per connection
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i = 0; i < num_conns; i++) {
+    workers[i].id = i;
+    workers[i].seed = start_time.tv_nsec ^ (i * 2654435761u);
+    pthread_create(&workers[i].tid, NULL, thread_task, &workers[i]);
   }
 
   // Join all the threads before leaving
-  for (int i = 0; i < num_threads; i++) {
-	pthread_join(ptid[i], NULL);
+  for (i = 0; i < num_conns; i++) {
+    pthread_join(workers[i].tid, NULL);
+    hist_merge(total, &workers[i].hist);
+    errors += workers[i].errors;
+    connects += workers[i].connects;
+    rejected += workers[i].rejected;
   }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
 
-  free(ptid);
-  return 0;
+  double secs = elapsed_ns(&start_time, &stop) / 1e9;
+  printf("\n====== Results ======\n");
+  printf("Mode: %s loop, %d connection(s)", rate > 0 ? "open" : "closed", num_conns);
+  if (keepalive) printf(", keep-alive, %d order(s) in flight", depth);
+  printf("\n");
+  printf("Orders: %lu served, %lu failed, %lu connection(s), %lu turned away in %.3f s\n",
+         total->total, errors, connects - rejected, rejected, secs);
+  printf("Throughput: %.2f orders/s\n", secs > 0 ? total->total / secs : 0.0);
+  if (total->total > 0) {
+    printf("Latency [ms]: min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f  "
+           "mean %.3f\n",
+           total->min / 1e3, hist_percentile(total, 50) / 1e3, hist_percentile(total, 90) / 1e3,
+           hist_percentile(total, 99) / 1e3, hist_percentile(total, 99.9) / 1e3,
+           total->max / 1e3, (double)total->sum / total->total / 1e3);
+  }
+
+  if (csvfn != NULL) {
+    FILE *csv = fopen(csvfn, "w");
+    if (csv == NULL) {
+      perror("fopen");
+    } else {
+      hist_csv(total, csv);
+      fclose(csv);
+    }
+  }
+
+  free(total);
+  free(workers);
+  return errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
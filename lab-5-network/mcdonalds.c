@@ -40,14 +40,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <signal.h>
 #include <pthread.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "net.h"
 #include "burger.h"
@@ -55,50 +62,159 @@
 /// @name Constant definitions
 /// @{
 
-#define CUSTOMER_MAX 10                                     ///< maximum number of clients
+#define CUSTOMER_MAX 10                                     ///< default max. number of customers
+#define LISTEN_BACKLOG 128                                  ///< default listen() backlog
+#define COOK_TIME 5                                         ///< seconds to make a burger (batch)
+#define STAT_SHARDS 16                                      ///< number of statistics shards
+#define SVC_SUB_BITS 4                                      ///< log2(histogram buckets per octave)
+#define SVC_BUCKETS ((64 - SVC_SUB_BITS) << SVC_SUB_BITS)   ///< service time histogram buckets
+#define STATS_SAMPLES 11                                    ///< throughput samples, one per second
 #define NUM_KITCHEN 5                                       ///< number of kitchen thread(s)
+#define MAX_EVENTS 64                                       ///< epoll events per epoll_wait()
+#define ORDER_QUEUE_SIZE 1024                               ///< capacity of the order queue
+#define KITCHEN_IDLE_MS 500                                 ///< idle kitchens re-check keep_running
+#define MAX_BATCH 64                                        ///< maximum kitchen batch size
+#define ORDER_POOL_CHUNK 256                                ///< order nodes allocated at once
+#define ERR_MALFORMED " Error: malformed order, expected '#<id> <burger>'\n" ///< after the tag
+#define ERR_NO_BURGER " Error: no such burger\n"            ///< error reply after the tag
+#define ERR_ENQUEUE   " Error: cannot enqueue the order\n"  ///< error reply after the tag
+#define NO_TAG ULONG_MAX                                    ///< tag of lines without an order id
 
 /// @}
 
 /// @name Structures
 /// @{
 
-/// @brief general node element to implement a singly-linked list
+/// @brief order element. Nodes live in the order pool; cond and mutex are initialized once when
+///        the node is created and reused by every order the node carries.
 typedef struct __node {
-  struct __node *next;                                      ///< pointer to next node
+  struct __node *next;                                      ///< next free node in the order pool
   unsigned int customerID;                                  ///< customer ID that requested
   enum burger_type type;                                    ///< requested burger type
-  bool is_ready;                                            ///< true if burger is ready
-  pthread_cond_t cond;                                      ///< conditional variable
-  pthread_mutex_t mutex;                                    ///< mutex variable
+  bool is_ready;                                            ///< true if burger is ready (mutex)
+  pthread_cond_t cond;                                      ///< signalled when is_ready is set
+  pthread_mutex_t mutex;                                    ///< protects is_ready
+  void (*notify)(struct __node *);                          ///< completion callback (NULL: cond)
+  void *arg;                                                ///< argument for notify
+  unsigned long tag;                                        ///< order id of pipelined orders
+  struct timespec queued;                                   ///< time the order was enqueued
 } Node;
 
-/// @brief order data
-typedef struct __order_list {
-  Node *head;                                               ///< head of order list
-  Node *tail;                                               ///< tail of order list
-  unsigned int count;                                       ///< number of nodes in list
-} OrderList;
-
-/// @brief structure for server context
+/// @brief bounded multi-producer/multi-consumer FIFO of orders. Producers (serving threads and
+///        event loops) and consumers (kitchens) block on condition variables instead of polling.
+///        The counters are protected by lock and measure the cost of the queue itself.
+typedef struct __order_queue {
+  Node **slot;                                              ///< ring buffer of size entries
+  unsigned int size;                                        ///< capacity
+  unsigned int head;                                        ///< index of oldest order
+  unsigned int count;                                       ///< number of orders in the ring
+  pthread_mutex_t lock;                                     ///< protects all fields
+  pthread_cond_t not_empty;                                 ///< signalled on enqueue
+  pthread_cond_t batch;                                     ///< broadcast on enqueue to collectors
+  unsigned int collectors;                                  ///< kitchens waiting in queue_take()
+  pthread_cond_t not_full;                                  ///< signalled on dequeue
+  unsigned long enqueued, dequeued;                         ///< number of operations
+  unsigned long full_waits, empty_waits;                    ///< times a caller had to block
+  uint64_t enqueue_ns, dequeue_ns;                          ///< time spent in critical sections
+  uint64_t delay_ns;                                        ///< sum of enqueue-to-dequeue delays
+} OrderQueue;
+
+/// @brief recyclable pool of order nodes. The pool grows by ORDER_POOL_CHUNK nodes when it runs
+///        empty and never shrinks, so a steady-state order costs no allocation.
+typedef struct __order_pool {
+  Node *free;                                               ///< list of free nodes
+  pthread_mutex_t lock;                                     ///< protects all fields
+  unsigned int nodes;                                       ///< number of nodes created
+  unsigned int in_use;                                      ///< number of nodes handed out
+} OrderPool;
+
+/// @brief one shard of the server statistics. Every thread is assigned a shard and updates it with
+///        relaxed atomic adds (STAT_ADD); readers sum up all shards. Shards are cache-line aligned,
+///        so threads on different shards never write to the same cache line.
+typedef struct __attribute__((aligned(64))) __stat_shard {
+  unsigned long burgers[BURGER_TYPE_MAX];                   ///< burgers produced by type
+  unsigned long batches;                                    ///< kitchen passes
+  unsigned long rejected;                                   ///< customers turned away
+  unsigned long service[SVC_BUCKETS];                       ///< service time histogram (us)
+  unsigned long service_sum;                                ///< sum of service times (us)
+  unsigned long service_max;                                ///< longest service time (us)
+} StatShard;
+
+/// @brief statistics summed up over all shards
+typedef struct {
+  unsigned long burgers[BURGER_TYPE_MAX];                   ///< burgers produced by type
+  unsigned long served;                                     ///< orders served (all types)
+  unsigned long batches;                                    ///< kitchen passes
+  unsigned long rejected;                                   ///< customers turned away
+  unsigned long service[SVC_BUCKETS];                       ///< service time histogram (us)
+  unsigned long service_sum;                                ///< sum of service times (us)
+  unsigned long service_max;                                ///< longest service time (us)
+} Stats;
+
+/// @brief structure for server context. The scalar counters are updated atomically.
 struct mcdonalds_ctx {
   unsigned int total_customers;                             ///< number of customers served
-  unsigned int total_burgers[BURGER_TYPE_MAX];              ///< number of burgers produced by types
   unsigned int total_queueing;                              ///< number of customers in queue
-  OrderList list;                                           ///< starting point of list structure
+  double kitchen_rate;                                      ///< measured kitchen capacity, orders/s
+  struct timespec started;                                  ///< start of the server
+  StatShard shard[STAT_SHARDS];                             ///< sharded statistics
+  OrderQueue queue;                                         ///< orders waiting for a kitchen
+  OrderPool pool;                                           ///< order nodes
 };
 
 
-/// @brief buffer for  multithreaded server 
-typedef struct {
-	int *buf;
-	int n;
-	int front;
-	int rear;
-	pthread_mutex_t mutex;
-	pthread_mutex_t slots;
-	pthread_mutex_t items;
-} sbuf_t;
+/// @brief pipelined session of a serving thread. Like the event loops, the serving thread does
+///        all client I/O itself; kitchens hand back finished orders through the completion list
+///        and wake the serving thread via an eventfd.
+typedef struct __session {
+  int fd;                                                   ///< client socket
+  int evfd;                                                 ///< eventfd signalled by kitchens
+  pthread_mutex_t lock;                                     ///< protects ready
+  Node *ready;                                              ///< finished orders (linked by next)
+  unsigned int outstanding;                                 ///< orders in the kitchen
+  bool broken;                                              ///< sending to the client failed
+} Session;
+
+/// @brief state of a connection in the event-driven front end
+typedef enum {
+  CS_ORDER,                                                 ///< welcome sent, reading order lines
+  CS_COOKING,                                               ///< one-shot order issued
+  CS_GOODBYE,                                               ///< sending final reply, then close
+} ConnState;
+
+/// @brief connection of the event-driven front end
+typedef struct __connection {
+  int fd;                                                   ///< client socket (non-blocking)
+  ConnState state;                                          ///< protocol state
+  bool pipelined;                                           ///< keep-alive protocol
+  bool eof;                                                 ///< client is done sending orders
+  bool closed;                                              ///< peer gone while cooking
+  unsigned int customerID;                                  ///< customer ID
+  unsigned int outstanding;                                 ///< orders in the kitchen
+  struct __event_loop *loop;                                ///< owning event loop
+  NetConn nc;                                               ///< buffered receive side
+  size_t outlen, outpos;                                    ///< bytes in out, bytes sent
+  size_t outcap;                                            ///< size of out
+  char *out;                                                ///< send buffer
+} Connection;
+
+/// @brief pre-formatted reply line
+typedef struct __reply {
+  char text[64];                                            ///< reply, including the newline
+  size_t len;                                               ///< length of text
+} Reply;
+
+/// @brief I/O thread of the event-driven front end. Each loop owns a listening socket (bound
+///        with SO_REUSEPORT) and an epoll instance; kitchens hand back finished orders through
+///        the completion list and wake the loop via an eventfd.
+typedef struct __event_loop {
+  pthread_t tid;                                            ///< thread running the loop
+  int epfd;                                                 ///< epoll instance
+  int listenfd;                                             ///< listening socket
+  int evfd;                                                 ///< eventfd signalled by kitchens
+  pthread_mutex_t lock;                                     ///< protects ready
+  Node *ready;                                              ///< finished orders (linked by next)
+} EventLoop;
 
 /// @}
 
@@ -109,258 +225,824 @@ int listenfd;                                               ///< listen file des
 struct mcdonalds_ctx server_ctx;                            ///< keeps server context
 sig_atomic_t keep_running = 1;                              ///< keeps all the threads running
 pthread_t kitchen_thread[NUM_KITCHEN];                      ///< thread for kitchen
-sbuf_t sbuf;												///< buffer for multithreaded server
-pthread_mutex_t mutex;										///< mutex for server_ctx
+bool event_mode = false;                                    ///< use the event-driven front end
+int num_loops = 0;                                          ///< number of event loops (0: #cores)
+int batch_size = 1;                                         ///< max. orders cooked in one pass
+int batch_wait_ms = 0;                                      ///< max. time to wait for a full batch
+int listen_backlog = LISTEN_BACKLOG;                        ///< listen() backlog
+int max_customers = -1;                                     ///< admitted customers (0: no limit)
+int max_delay_ms = 0;                                       ///< admission limit on expected delay
+int stats_port = 0;                                         ///< stats endpoint port (0: off)
+Reply reply_goodbye[BURGER_TYPE_MAX];                       ///< "Your .. burger is ready! Goodbye!"
+Reply reply_ready[BURGER_TYPE_MAX];                         ///< " Your .. burger is ready!", tagged
 
 /// @}
 
-/// @brief Create an empty bounded shared FIFO
-/// @param sp sbuffer 
-/// @param n size of buffer
-void sbuf_init(sbuf_t *sp, int n) {
-	sp->buf = (int*)malloc(n*sizeof(int));
-	sp->n = n;
-	sp->front = sp->rear = 0;
-	pthread_mutex_init(&sp->mutex, NULL);
-	pthread_mutex_init(&sp->slots, NULL);
-	pthread_mutex_init(&sp->items, NULL);
+/// @brief elapsed time between @a a and @a b in nanoseconds
+uint64_t elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec)*1000000000UL + b->tv_nsec - a->tv_nsec;
 }
 
-/// @brief clean up the buffer sp
-/// @param sp sbuffer
-void sbuf_deinit(sbuf_t *sp) {
-	free(sp->buf);
+/// @brief statistics shard of the calling thread. Threads are assigned shards round-robin.
+StatShard* stat_shard(void)
+{
+  static __thread StatShard *shard = NULL;
+  static unsigned int next = 0;
+
+  if (shard == NULL) {
+    shard = &server_ctx.shard[__atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % STAT_SHARDS];
+  }
+
+  return shard;
 }
 
-/// @brief insert an item onto the rear of the buffer sp
-/// @param sp sbuffer
-/// @param item item to insert
-void sbuf_insert(sbuf_t *sp, int item){
-	pthread_mutex_lock(&sp->slots);
-	pthread_mutex_lock(&sp->mutex);
-	sp->buf[(++sp->rear)%(sp->n)] = item;
-	pthread_mutex_unlock(&sp->mutex);
-	pthread_mutex_unlock(&sp->slots);
+/// @brief add @a v to statistics counter @a field of the calling thread's shard
+#define STAT_ADD(field, v) __atomic_fetch_add(&stat_shard()->field, (v), __ATOMIC_RELAXED)
+
+/// @brief raise statistics counter @a field of the calling thread's shard to at least @a v
+#define STAT_MAX(field, v) stat_max(&stat_shard()->field, (v))
+
+/// @brief atomically raise counter @a p to at least @a v
+void stat_max(unsigned long *p, unsigned long v)
+{
+  unsigned long cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+  while ((cur < v) &&
+         !__atomic_compare_exchange_n(p, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 }
 
-/// @brief remove and return the first item of the buffer sp
-/// @param sp buffer
-/// @retVal item the first item in the buffer
-int sbuf_remove(sbuf_t *sp) {
-	int item;
-	pthread_mutex_lock(&sp->items);
-	pthread_mutex_lock(&sp->mutex);
-	item = sp->buf[(++sp->front)%(sp->n)];
-	pthread_mutex_unlock(&sp->mutex);
-	pthread_mutex_unlock(&sp->items);
+/// @brief service time histogram bucket of @a us microseconds. Log-linear: 2^SVC_SUB_BITS buckets
+///        per power of two.
+unsigned int svc_bucket(uint64_t us)
+{
+  if (us < (1 << SVC_SUB_BITS)) return us;
 
-	return item;
+  int shift = 63 - __builtin_clzll(us) - SVC_SUB_BITS;
+  return ((shift + 1) << SVC_SUB_BITS) + (unsigned int)(us >> shift) - (1 << SVC_SUB_BITS);
 }
 
+/// @brief largest service time (microseconds) in histogram bucket @a b
+uint64_t svc_value(unsigned int b)
+{
+  if (b < (1 << SVC_SUB_BITS)) return b;
 
-/// @brief Enqueue element in tail of the OrderList
-/// @param customerID customer ID
+  int shift = (b >> SVC_SUB_BITS) - 1;
+  unsigned int sub = b & ((1 << SVC_SUB_BITS) - 1);
+  return (((uint64_t)(1 << SVC_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+/// @brief sum up the statistics shards
+/// @param[out] s statistics
+void stats_collect(Stats *s)
+{
+  memset(s, 0, sizeof(*s));
+
+  for (int i = 0; i < STAT_SHARDS; i++) {
+    StatShard *sh = &server_ctx.shard[i];
+
+    for (int t = 0; t < BURGER_TYPE_MAX; t++) {
+      s->burgers[t] += __atomic_load_n(&sh->burgers[t], __ATOMIC_RELAXED);
+    }
+    s->batches += __atomic_load_n(&sh->batches, __ATOMIC_RELAXED);
+    s->rejected += __atomic_load_n(&sh->rejected, __ATOMIC_RELAXED);
+    for (int b = 0; b < SVC_BUCKETS; b++) {
+      s->service[b] += __atomic_load_n(&sh->service[b], __ATOMIC_RELAXED);
+    }
+    s->service_sum += __atomic_load_n(&sh->service_sum, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&sh->service_max, __ATOMIC_RELAXED);
+    if (max > s->service_max) s->service_max = max;
+  }
+  for (int t = 0; t < BURGER_TYPE_MAX; t++) s->served += s->burgers[t];
+}
+
+/// @brief service time quantile @a q (0..1) of statistics @a s in milliseconds. The quantile is
+///        interpolated linearly inside its histogram bucket and capped at the longest service
+///        time, since the buckets are up to 1/2^SVC_SUB_BITS of their value wide.
+double stats_quantile(const Stats *s, double q)
+{
+  unsigned long total = 0, seen = 0, rank;
+
+  for (int b = 0; b < SVC_BUCKETS; b++) total += s->service[b];
+  if (total == 0) return 0.0;
+
+  rank = (unsigned long)(q * total + 0.5);
+  if (rank < 1) rank = 1;
+  for (int b = 0; b < SVC_BUCKETS; b++) {
+    if (seen + s->service[b] >= rank) {
+      uint64_t lo = (b > 0) ? svc_value(b - 1) + 1 : 0, hi = svc_value(b);
+      double us = lo + (double)(hi - lo) * (rank - seen) / s->service[b];
+      return (us < s->service_max ? us : s->service_max) / 1e3;
+    }
+    seen += s->service[b];
+  }
+
+  return 0.0;
+}
+
+/// @brief compute the absolute CLOCK_REALTIME time @a ms milliseconds from now
+/// @param[out] ts deadline for pthread_cond_timedwait()
+/// @param ms milliseconds
+void deadline_after(struct timespec *ts, long ms)
+{
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+/// @brief initialize order queue @a q with room for @a size orders
+/// @param q order queue
+/// @param size capacity
+/// @retval 0 on success, -1 if out of memory
+int queue_init(OrderQueue *q, unsigned int size)
+{
+  memset(q, 0, sizeof(*q));
+  if ((q->slot = malloc(size*sizeof(Node*))) == NULL) return -1;
+  q->size = size;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->batch, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+
+  return 0;
+}
+
+/// @brief append @a order to the tail of order queue @a q, wake one idle kitchen, and let the
+///        kitchens collecting a batch check whether the order is theirs
+/// @param q order queue
+/// @param order order
+/// @param block wait for a free slot if the queue is full (event loops must not block)
+/// @retval true if the order was enqueued
+/// @retval false if the queue is full and @a block is false
+bool queue_push(OrderQueue *q, Node *order, bool block)
+{
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_mutex_lock(&q->lock);
+  if (q->count == q->size) {
+    if (!block) {
+      pthread_mutex_unlock(&q->lock);
+      return false;
+    }
+    q->full_waits++;
+    while (q->count == q->size) pthread_cond_wait(&q->not_full, &q->lock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  }
+
+  q->slot[(q->head + q->count) % q->size] = order;
+  q->count++;
+  order->queued = start;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  q->enqueued++;
+  q->enqueue_ns += elapsed_ns(&start, &end);
+  bool collect = q->collectors > 0;
+  pthread_mutex_unlock(&q->lock);
+  pthread_cond_signal(&q->not_empty);
+  if (collect) pthread_cond_broadcast(&q->batch);
+
+  return true;
+}
+
+/// @brief remove the order at the head of order queue @a q. Blocks while the queue is empty,
+///        but at most @a timeout_ms milliseconds.
+/// @param q order queue
+/// @param timeout_ms maximum time to wait for an order
+/// @retval Node* oldest order
+/// @retval NULL if no order arrived within @a timeout_ms
+Node* queue_pop(OrderQueue *q, long timeout_ms)
+{
+  struct timespec start, end, deadline;
+  Node *order;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_mutex_lock(&q->lock);
+  if (q->count == 0) {
+    deadline_after(&deadline, timeout_ms);
+
+    q->empty_waits++;
+    while (q->count == 0) {
+      if (pthread_cond_timedwait(&q->not_empty, &q->lock, &deadline) == ETIMEDOUT) break;
+    }
+    if (q->count == 0) {
+      pthread_mutex_unlock(&q->lock);
+      return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  }
+
+  order = q->slot[q->head];
+  q->head = (q->head + 1) % q->size;
+  q->count--;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  q->dequeued++;
+  q->dequeue_ns += elapsed_ns(&start, &end);
+  q->delay_ns += elapsed_ns(&order->queued, &end);
+  pthread_mutex_unlock(&q->lock);
+  pthread_cond_signal(&q->not_full);
+
+  return order;
+}
+
+/// @brief remove up to @a max orders of burger @a type from order queue @a q, wherever they are
+///        in the queue; the order of the remaining entries is preserved. Waits up to @a wait_ms
+///        milliseconds for more orders of that type until @a max orders are collected. Orders of
+///        other types are left to the idle kitchens, which queue_push() wakes independently.
+/// @param q order queue
 /// @param type burger type
-/// @retval Node* containing the node structure of the element
-Node* issue_order(unsigned int customerID, enum burger_type type)
+/// @param[out] batch removed orders, oldest first
+/// @param max capacity of @a batch
+/// @param wait_ms maximum time to wait for more orders
+/// @retval number of orders removed (0..max)
+int queue_take(OrderQueue *q, enum burger_type type, Node **batch, int max, long wait_ms)
 {
-  Node *new_node = malloc(sizeof(Node));
+  struct timespec deadline, now;
+  int n = 0;
 
-  new_node->customerID = customerID;
-  new_node->type = type;
-  new_node->next = NULL;
-  new_node->is_ready = false;
-  pthread_cond_init(&new_node->cond, NULL);
-  pthread_mutex_init(&new_node->mutex, NULL);
+  deadline_after(&deadline, wait_ms);
+  pthread_mutex_lock(&q->lock);
+  while (1) {
+    unsigned int i, kept = 0;
+
+    // 1. compact the ring, moving matching orders into the batch
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < q->count; i++) {
+      Node *order = q->slot[(q->head + i) % q->size];
+      if ((n < max) && (order->type == type)) {
+        batch[n++] = order;
+        q->dequeued++;
+        q->delay_ns += elapsed_ns(&order->queued, &now);
+      } else {
+        q->slot[(q->head + kept++) % q->size] = order;
+      }
+    }
+    q->count = kept;
 
-  if (server_ctx.list.tail == NULL) {
-    server_ctx.list.head = new_node;
-    server_ctx.list.tail = new_node;
-  } else {
-    server_ctx.list.tail->next = new_node;
-    server_ctx.list.tail = new_node;
+    // 2. wait for more orders until the deadline
+    if ((n == max) || (wait_ms <= 0)) break;
+
+    q->collectors++;
+    if (pthread_cond_timedwait(&q->batch, &q->lock, &deadline) == ETIMEDOUT) wait_ms = 0;
+    q->collectors--;
   }
+  pthread_mutex_unlock(&q->lock);
+  if (n > 0) pthread_cond_broadcast(&q->not_full);
 
-  server_ctx.list.count++;
+  return n;
+}
 
-  return new_node;
+/// @brief initialize order pool @a p
+/// @param p order pool
+void pool_init(OrderPool *p)
+{
+  memset(p, 0, sizeof(*p));
+  pthread_mutex_init(&p->lock, NULL);
 }
 
-/// @brief Dequeue element from the OrderList
-/// @retval Node* Node from head of the list
-Node* get_order(void)
+/// @brief take a node from order pool @a p, growing the pool if it is empty
+/// @param p order pool
+/// @retval Node* node with initialized cond and mutex
+/// @retval NULL if out of memory
+Node* pool_get(OrderPool *p)
 {
-  Node *target_node;
+  Node *node;
+
+  pthread_mutex_lock(&p->lock);
+  if (p->free == NULL) {
+    Node *chunk = malloc(ORDER_POOL_CHUNK*sizeof(Node));
+    if (chunk == NULL) {
+      pthread_mutex_unlock(&p->lock);
+      return NULL;
+    }
+    for (int i = 0; i < ORDER_POOL_CHUNK; i++) {
+      pthread_cond_init(&chunk[i].cond, NULL);
+      pthread_mutex_init(&chunk[i].mutex, NULL);
+      chunk[i].next = p->free;
+      p->free = &chunk[i];
+    }
+    p->nodes += ORDER_POOL_CHUNK;
+  }
 
-  if (server_ctx.list.head == NULL) return NULL;
+  node = p->free;
+  p->free = node->next;
+  p->in_use++;
+  pthread_mutex_unlock(&p->lock);
+
+  return node;
+}
 
-  target_node = server_ctx.list.head;
+/// @brief return @a node to order pool @a p. Nobody may wait on or signal the node anymore.
+/// @param p order pool
+/// @param node node obtained from pool_get(p)
+void pool_put(OrderPool *p, Node *node)
+{
+  pthread_mutex_lock(&p->lock);
+  node->next = p->free;
+  p->free = node;
+  p->in_use--;
+  pthread_mutex_unlock(&p->lock);
+}
 
+/// @brief Enqueue a new order
+/// @param customerID customer ID
+/// @param type burger type
+/// @param notify completion callback invoked by the kitchen, or NULL to signal order->cond
+/// @param arg argument for @a notify, stored in order->arg
+/// @param tag order id of pipelined orders, stored in order->tag
+/// @retval Node* containing the node structure of the element
+/// @retval NULL if out of memory, or if the queue is full and the caller is an event loop
+Node* issue_order(unsigned int customerID, enum burger_type type,
+                  void (*notify)(Node *), void *arg, unsigned long tag)
+{
+  Node *new_node = pool_get(&server_ctx.pool);
+  if (new_node == NULL) return NULL;
 
-  if (server_ctx.list.head == server_ctx.list.tail) {
-    server_ctx.list.head = NULL;
-    server_ctx.list.tail = NULL;
-  } else {
-    server_ctx.list.head = server_ctx.list.head->next;
+  new_node->customerID = customerID;
+  new_node->type = type;
+  new_node->next = NULL;
+  new_node->is_ready = false;
+  new_node->notify = notify;
+  new_node->arg = arg;
+  new_node->tag = tag;
+
+  // serving threads wait for a free slot; event loops (notify != NULL) must not block
+  if (!queue_push(&server_ctx.queue, new_node, notify == NULL)) {
+    pool_put(&server_ctx.pool, new_node);
+    return NULL;
   }
 
-  server_ctx.list.count--;
+  return new_node;
+}
 
+/// @brief wait until @a order is ready and return its node to the pool
+/// @param order order issued with notify == NULL
+void wait_order(Node *order)
+{
+  pthread_mutex_lock(&order->mutex);
+  while (!order->is_ready) pthread_cond_wait(&order->cond, &order->mutex);
+  pthread_mutex_unlock(&order->mutex);
 
-  return target_node;
+  pool_put(&server_ctx.pool, order);
 }
 
-/// @brief Returns number of element left in OrderList
-/// @retval number of element(s) in OrderList
+/// @brief Dequeue the oldest order. Waits up to KITCHEN_IDLE_MS for an order to arrive.
+/// @retval Node* oldest order
+/// @retval NULL if there is none
+Node* get_order(void)
+{
+  return queue_pop(&server_ctx.queue, KITCHEN_IDLE_MS);
+}
+
+/// @brief Returns number of orders left in the queue
+/// @retval number of order(s) in the queue
 unsigned int order_left(void)
 {
-  int ret;
+  unsigned int ret;
 
-  ret = server_ctx.list.count;
+  pthread_mutex_lock(&server_ctx.queue.lock);
+  ret = server_ctx.queue.count;
+  pthread_mutex_unlock(&server_ctx.queue.lock);
 
   return ret;
 }
 
 /// @brief Kitchen task for kitchen thread
+///        With batching (batch_size > 1), the kitchen collects up to batch_size orders of the type
+///        of the oldest order, waiting at most batch_wait_ms for more, and cooks them in one pass.
 void* kitchen_task(void *dummy)
 {
-  Node *order;
+  Node *batch[MAX_BATCH];
+  struct timespec start, end;
   enum burger_type type;
+  int i, n;
   pthread_t tid = pthread_self();
   pthread_detach(tid); //detach itself
   printf("Kitchen thread %lu ready\n", tid);
 
   while (keep_running || order_left()) {
-	order = get_order();
-	if (order == NULL) {
-      	sleep(2);
-      continue;
-    }
-
-	pthread_mutex_lock(&order->mutex);
-    type = order->type;
-    printf("[Thread %lu] generating %s burger\n", tid, burger_names[type]);
-    sleep(5);
-    printf("[Thread %lu] %s burger is ready\n", tid, burger_names[type]);
+    batch[0] = get_order();
+    if (batch[0] == NULL) continue;
 
-    server_ctx.total_burgers[type]++;
+    type = batch[0]->type;
+    n = 1;
+    if (batch_size > 1) {
+      n += queue_take(&server_ctx.queue, type, &batch[1], batch_size - 1, batch_wait_ms);
+    }
 
-    order->is_ready = true;
+    printf("[Thread %lu] generating %d %s burger(s)\n", tid, n, burger_names[type]);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sleep(COOK_TIME);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("[Thread %lu] %d %s burger(s) ready\n", tid, n, burger_names[type]);
+
+    STAT_ADD(burgers[type], n);
+    STAT_ADD(batches, 1);
+    for (i = 0; i < n; i++) {
+      uint64_t us = elapsed_ns(&batch[i]->queued, &end) / 1000;
+      STAT_ADD(service[svc_bucket(us)], 1);
+      STAT_ADD(service_sum, us);
+      STAT_MAX(service_max, us);
+    }
 
-	pthread_mutex_unlock(&order->mutex);
-    pthread_cond_signal(&order->cond);
+    // capacity of all kitchens if they were working like this one, smoothed over passes. An
+    // update racing with another kitchen's may get lost, which an average can afford
+    double rate;
+    __atomic_load(&server_ctx.kitchen_rate, &rate, __ATOMIC_RELAXED);
+    rate = 0.8 * rate + 0.2 * NUM_KITCHEN * n * 1e9 / elapsed_ns(&start, &end);
+    __atomic_store(&server_ctx.kitchen_rate, &rate, __ATOMIC_RELAXED);
+
+    // hand out the whole batch. The waiter recycles the node as soon as it sees is_ready, so
+    // signal while holding the node's mutex; notify callbacks own the node once called
+    for (i = 0; i < n; i++) {
+      Node *order = batch[i];
+
+      if (order->notify != NULL) {
+        order->is_ready = true;
+        order->notify(order);
+      } else {
+        pthread_mutex_lock(&order->mutex);
+        order->is_ready = true;
+        pthread_cond_signal(&order->cond);
+        pthread_mutex_unlock(&order->mutex);
+      }
+    }
   }
 
   printf("[Thread %lu] terminated\n", tid);
   pthread_exit(NULL);
 }
 
+/// @brief admission control: decide whether a new customer is served. A customer is turned away
+///        if max_customers customers are already being served, or if the pending work would keep
+///        the kitchens busy for more than max_delay_ms at their measured capacity. Pending work
+///        is the number of queued orders, or of admitted customers if that is larger (they have
+///        not necessarily ordered yet), minus what the kitchens can start on right away.
+///        Admitted customers are counted in total_queueing; see depart().
+/// @retval 0 if the customer is admitted
+/// @retval >0 suggested time in milliseconds until the customer should retry
+long admit(void)
+{
+  long retry = 0;
+  double rate;
+
+  // reserve a place first so that concurrent admissions see each other
+  unsigned int in_service = __atomic_fetch_add(&server_ctx.total_queueing, 1, __ATOMIC_RELAXED);
+  __atomic_load(&server_ctx.kitchen_rate, &rate, __ATOMIC_RELAXED);
+
+  unsigned int pending = order_left();
+  if (in_service > pending) pending = in_service;
+  pending = pending > NUM_KITCHEN ? pending - NUM_KITCHEN : 0;
+  double delay_ms = pending * 1000.0 / rate;
+
+  if ((max_customers > 0) && (in_service >= (unsigned int)max_customers)) {
+    retry = delay_ms > 1000.0 / rate ? delay_ms : 1000.0 / rate;
+  } else if ((max_delay_ms > 0) && (delay_ms > max_delay_ms)) {
+    retry = delay_ms - max_delay_ms;
+  }
+
+  if (retry > 0) {
+    __atomic_fetch_sub(&server_ctx.total_queueing, 1, __ATOMIC_RELAXED);
+    STAT_ADD(rejected, 1);
+  }
+
+  return retry;
+}
+
+/// @brief an admitted customer leaves
+void depart(void)
+{
+  __atomic_fetch_sub(&server_ctx.total_queueing, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief turn a customer away before spending any resources on it. Does not block.
+/// @param fd client socket; closed
+/// @param retry_ms suggested time until retry
+void reject(int fd, long retry_ms)
+{
+  char msg[64];
+  int len = snprintf(msg, sizeof(msg), "Busy, retry after %ld ms\n", retry_ms);
+
+  if (send(fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) perror("send");
+  close(fd);
+}
+
+/// @brief format @a v in decimal
+/// @param buf output buffer of at least 20 characters. Not '\0'-terminated.
+/// @param v value
+/// @retval number of characters written
+size_t fmt_ulong(char *buf, unsigned long v)
+{
+  char digits[20];
+  size_t n = 0, i;
+
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v > 0);
+  for (i = 0; i < n; i++) buf[i] = digits[n - 1 - i];
+
+  return n;
+}
+
+/// @brief format the tag "#<tag>" of a pipelined reply
+/// @param buf output buffer of at least 21 characters. Not '\0'-terminated.
+/// @param tag order id
+/// @retval number of characters written
+size_t fmt_tag(char *buf, unsigned long tag)
+{
+  buf[0] = '#';
+  return 1 + fmt_ulong(buf + 1, tag);
+}
+
+/// @brief build the error reply @a err to a pipelined order line. The reply carries the tag
+///        "#<tag>" of the line; lines without an order id (@a tag == NO_TAG) are answered with
+///        the bare error, since any tag would name a valid order.
+/// @param[out] iov two I/O vectors, tag and error
+/// @param tagbuf buffer for the tag of at least 21 characters
+/// @param tag order id, or NO_TAG
+/// @param err error reply (ERR_*)
+void fmt_error(struct iovec *iov, char *tagbuf, unsigned long tag, const char *err)
+{
+  iov[0].iov_base = tagbuf;
+  iov[0].iov_len = 0;
+  if (tag != NO_TAG) iov[0].iov_len = fmt_tag(tagbuf, tag);
+  else err++;                                               // skip the blank after the tag
+
+  iov[1].iov_base = (char*)err;
+  iov[1].iov_len = strlen(err);
+}
+
+/// @brief format the welcome line of customer @a customerID
+/// @param buf output buffer of at least 64 characters. Not '\0'-terminated.
+/// @param customerID customer ID
+/// @retval number of characters written
+size_t fmt_welcome(char *buf, unsigned int customerID)
+{
+  static const char welcome[] = "Welcome to McDonald's, customer #";
+  size_t len = sizeof(welcome) - 1;
+
+  memcpy(buf, welcome, len);
+  len += fmt_ulong(buf + len, customerID);
+  buf[len++] = '\n';
+
+  return len;
+}
+
+/// @brief build the reply templates of all burgers
+void init_replies(void)
+{
+  enum burger_type type;
+
+  for (type = BURGER_BIGMAC; type < BURGER_TYPE_MAX; type++) {
+    reply_goodbye[type].len = snprintf(reply_goodbye[type].text, sizeof(reply_goodbye[type].text),
+                                       "Your %s burger is ready! Goodbye!\n", burger_names[type]);
+    reply_ready[type].len = snprintf(reply_ready[type].text, sizeof(reply_ready[type].text),
+                                     " Your %s burger is ready!\n", burger_names[type]);
+  }
+}
+
+/// @brief parse an order line in place
+/// @param line order line, not necessarily '\0'-terminated
+/// @param len length of @a line, including the newline if any
+/// @retval burger type, or BURGER_TYPE_MAX if there is no such burger
+enum burger_type parse_order(const char *line, size_t len)
+{
+  if ((len > 0) && (line[len - 1] == '\n')) len--;
+  if ((len > 0) && (line[len - 1] == '\r')) len--;
+
+  return burger_lookup(line, len);
+}
+
+/// @brief parse a pipelined order line "#<id> <burger>" in place
+/// @param line order line starting with '#', not necessarily '\0'-terminated
+/// @param len length of @a line, including the newline if any
+/// @param[out] tag order id, or NO_TAG if the line does not start with one
+/// @retval burger type, or BURGER_TYPE_MAX if the line is malformed or there is no such burger
+enum burger_type parse_tagged_order(const char *line, size_t len, unsigned long *tag)
+{
+  unsigned long v = 0;
+  size_t i = 1;
+
+  while ((i < len) && (line[i] >= '0') && (line[i] <= '9')) v = 10*v + (line[i++] - '0');
+  *tag = (i > 1) ? v : NO_TAG;
+  if ((i == 1) || (i == len) || (line[i] != ' ')) return BURGER_TYPE_MAX;
+
+  return parse_order(line + i + 1, len - i - 1);
+}
+
+/// @brief completion callback of pipelined orders of a serving thread. Called by kitchen threads;
+///        appends the order to the session's completion list and wakes the serving thread. The
+///        eventfd is written while holding the lock: once the serving thread has taken the last
+///        order, it may tear down the session.
+/// @param order finished order
+void session_order_ready(Node *order)
+{
+  Session *s = order->arg;
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&s->lock);
+  order->next = s->ready;
+  s->ready = order;
+  if (write(s->evfd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+  pthread_mutex_unlock(&s->lock);
+}
+
+/// @brief send the tagged replies of the orders finished by the kitchens and return their nodes
+///        to the pool. Once sending has failed, the remaining orders are only collected.
+/// @param s session
+void session_complete(Session *s)
+{
+  uint64_t cnt;
+  Node *order;
+
+  if (read(s->evfd, &cnt, sizeof(cnt)) < 0) return;
+
+  pthread_mutex_lock(&s->lock);
+  order = s->ready;
+  s->ready = NULL;
+  pthread_mutex_unlock(&s->lock);
+
+  while (order != NULL) {
+    Node *next = order->next;
+    const Reply *r = &reply_ready[order->type];
+    char tag[24];
+    struct iovec iov[2] = {
+      { .iov_base = tag, .iov_len = fmt_tag(tag, order->tag) },
+      { .iov_base = (char*)r->text, .iov_len = r->len },
+    };
+
+    if (!s->broken && (put_datav(s->fd, iov, 2) < 0)) s->broken = true;
+
+    pool_put(&server_ctx.pool, order);
+    s->outstanding--;
+    order = next;
+  }
+}
+
+/// @brief serve a customer that uses the keep-alive protocol. Orders are issued as they arrive
+///        and replied to, tagged with their id, as soon as the kitchen has made them. The serving
+///        thread waits for new order lines and for finished orders at the same time. Returns
+///        once the customer has stopped sending (or cannot be sent to anymore) and all orders
+///        have left the kitchen.
+/// @param clientfd client socket
+/// @param nc buffered receive side of @a clientfd
+/// @param customerID customer ID
+/// @param line first order line, not '\0'-terminated
+/// @param len length of @a line
+void serve_pipelined(int clientfd, NetConn *nc, unsigned int customerID, const char *line,
+                     int len)
+{
+  Session s = { .fd = clientfd, .ready = NULL, .outstanding = 0, .broken = false };
+  bool eof = false;
+
+  if ((s.evfd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    perror("eventfd");
+    return;
+  }
+  pthread_mutex_init(&s.lock, NULL);
+
+  while (1) {
+    // 1. issue the buffered order lines
+    for (; len > 0; len = nc_next_span(nc, &line)) {
+      unsigned long tag = NO_TAG;
+      enum burger_type type = BURGER_TYPE_MAX;
+      const char *err = NULL;
+
+      if (line[0] != '#') {
+        err = ERR_MALFORMED;
+      } else if ((type = parse_tagged_order(line, len, &tag)) == BURGER_TYPE_MAX) {
+        err = (tag == NO_TAG) ? ERR_MALFORMED : ERR_NO_BURGER;
+      } else if (issue_order(customerID, type, session_order_ready, &s, tag) == NULL) {
+        err = ERR_ENQUEUE;
+      } else {
+        s.outstanding++;
+      }
+
+      if ((err != NULL) && !s.broken) {
+        char tagbuf[24];
+        struct iovec iov[2];
+        fmt_error(iov, tagbuf, tag, err);
+        if (put_datav(clientfd, iov, 2) < 0) s.broken = true;
+      }
+    }
+
+    // 2. done once no more orders can arrive and the kitchens have returned all orders
+    bool reading = !eof && !s.broken;
+    if (!reading && (s.outstanding == 0)) break;
+
+    // 3. wait for finished orders and, while the customer is ordering, for order lines
+    struct pollfd pfd[2] = {
+      { .fd = s.evfd, .events = POLLIN },
+      { .fd = clientfd, .events = POLLIN },
+    };
+    if (poll(pfd, reading ? 2 : 1, -1) < 0) {
+      if (errno != EINTR) perror("poll");
+      continue;
+    }
+
+    if (pfd[0].revents & POLLIN) session_complete(&s);
+    if (reading && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+      if (nc_fill(nc) <= 0) eof = true;
+      else len = nc_next_span(nc, &line);
+    }
+  }
+
+  pthread_mutex_destroy(&s.lock);
+  close(s.evfd);
+}
+
 /// @brief client task for client thread
-/// @param newsock socketID of the client as void*
+/// @param newsock socket of the client, passed by value as (void*)(intptr_t)
 void* serve_client(void *newsock)
 {
   ssize_t read, sent;
-  size_t msglen;
-  char *message, *burger, *buffer;
+  char welcome[64];
+  const char *line;
+  NetConn nc;
   unsigned int customerID;
   enum burger_type type;
   Node *order = NULL;
-  int ret, i, clientfd, queued;
-
-  clientfd = sbuf_remove(&sbuf);
-  buffer = (char *) malloc(BUF_SIZE);
-  msglen = BUF_SIZE;
+  int clientfd;
 
+  clientfd = (int)(intptr_t)newsock;
 
   pthread_detach(pthread_self());
 
-  pthread_mutex_lock(&mutex);
-  queued = ++server_ctx.total_queueing;
-  pthread_mutex_unlock(&mutex);
-
-  if (queued > CUSTOMER_MAX) {
-	printf("Max number of customers exceeded, Good bye!\n");
-	goto err;
+  // order lines longer than BUF_SIZE are not orders
+  if (nc_init(&nc, clientfd, BUF_SIZE, BUF_SIZE) < 0) {
+    printf("Error: out of memory\n");
+    goto err;
   }
 
-  pthread_mutex_lock(&mutex);
-  customerID = server_ctx.total_customers++;
-  pthread_mutex_unlock(&mutex);
+  customerID = __atomic_fetch_add(&server_ctx.total_customers, 1, __ATOMIC_RELAXED);
 
   printf("Customer #%d visited\n", customerID);
   // send welcome to mcdonalds
-  ret = asprintf(&message, "Welcome to McDonald's, customer #%d\n", customerID);
-  if (ret < 0) {
-    perror("asprintf");
-    return NULL;
-  }
-
-  sent = put_line(clientfd, message, ret);
+  sent = put_data(clientfd, welcome, fmt_welcome(welcome, customerID));
   if (sent < 0) {
     printf("Error: cannot send data to client\n");
     goto err;
   }
-  free(message);
 
   // receive order from the customer
-  read = get_line(clientfd, &buffer, &msglen);
+  read = nc_get_span(&nc, &line);
   if (read <= 0) {
 	printf("Error: cannot read data from client\n");
 	goto err;
   }
- 
-  // parse order from the customer
-  burger = strtok(buffer, "\n"); // buffer ==> bulgogi\n, ... remove new_line;
-  // if burger is not available, exit connection
-  //burger_names = {"bigmac", "cheese", "chicken", "bulgogi"};
-  for (type = BURGER_BIGMAC, i = 0;  type < BURGER_TYPE_MAX; type++, i++) {
-	if (!strcmp(burger_names[type], burger)) break;
+
+  // a tagged first order selects the keep-alive protocol
+  if (line[0] == '#') {
+    serve_pipelined(clientfd, &nc, customerID, line, read);
+    goto err;
   }
+
+  // parse order from the customer; if burger is not available, exit connection
+  type = parse_order(line, read);
   if (type == BURGER_TYPE_MAX) {
 	printf("Error: there's no such burger\n");
 	goto err;
   }
   // issue order to kitchen and wait
-  if ((order = issue_order(customerID, type)) == NULL) {
+  if ((order = issue_order(customerID, type, NULL, NULL, 0)) == NULL) {
 	printf("Error: cannot enqueue the order.\n"); 
 	goto err;
   }
-  
-  pthread_cond_wait(&order->cond, &order->mutex);
+  wait_order(order);
 
-  // if order successfully handled, hand burger and say goodbye
-  if (order->is_ready) {
-    ret = asprintf(&message, "Your %s burger is ready! Goodbye!\n", burger_names[i]);
-    sent = put_line(clientfd, message, ret);
-    if (sent <= 0) {
-      printf("Error: cannot send data to client\n");
-      goto err;
-    }
-    free(message);
+  // order successfully handled, hand burger and say goodbye
+  sent = put_data(clientfd, reply_goodbye[type].text, reply_goodbye[type].len);
+  if (sent <= 0) {
+    printf("Error: cannot send data to client\n");
+    goto err;
   }
 
-  free(order);
-
 err:
-  pthread_mutex_lock(&mutex);
-  server_ctx.total_queueing--;
-  pthread_mutex_unlock(&mutex);
+  depart();
 
   close(clientfd);
-  free(buffer);
+  nc_free(&nc);
   pthread_exit(NULL);
 }
 
-/// @brief start server listening
-void start_server()
+/// @brief create a listening socket
+/// @param port port number
+/// @param reuseport set SO_REUSEPORT so that several sockets can share the port
+/// @retval listening socket. Terminates the server on failure.
+int create_listener(unsigned short port, int reuseport)
 {
-  int clientfd, addrlen, opt = 1;
+  int fd = -1, opt = 1;
   int ret;
-  struct sockaddr_in client;
   struct addrinfo *ai, *ai_it;
 
   // get socket list
-  ai = getsocklist(NULL, PORT, AF_UNSPEC, SOCK_STREAM, 1, &ret);
+  ai = getsocklist(NULL, port, AF_UNSPEC, SOCK_STREAM, 1, &ret);
 
   // if there's an error print message and exit
   if (ret) {
@@ -370,23 +1052,425 @@ void start_server()
 
   ai_it = ai;
   while (ai_it != NULL) {
-	listenfd = socket(ai_it->ai_family, ai_it->ai_socktype, ai_it->ai_protocol);
-	if (listenfd != 1) {
-		setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void*)&opt, sizeof(int));
-		if (bind(listenfd, ai_it->ai_addr, ai_it->ai_addrlen)) {
-			close(listenfd);
+	fd = socket(ai_it->ai_family, ai_it->ai_socktype, ai_it->ai_protocol);
+	if (fd != -1) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const void*)&opt, sizeof(int));
+		if (reuseport) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const void*)&opt, sizeof(int));
+		if (bind(fd, ai_it->ai_addr, ai_it->ai_addrlen)) {
+			close(fd);
 			perror("bind: ");
 			exit(EXIT_FAILURE);
 		}
-		if (listen(listenfd, 5)){
+		if (listen(fd, listen_backlog)){
 			perror("listen:");
-			continue;
+			close(fd);
+			fd = -1;
+		} else {
+			break;
 		}
-		break;
 	}
 	ai_it = ai_it->ai_next;
   }
   freeaddrinfo(ai);
+
+  if (fd == -1) {
+	printf("Error: cannot create listening socket\n");
+	exit(EXIT_FAILURE);
+  }
+
+  return fd;
+}
+
+/// @brief (re-)register connection @a c with its loop's epoll instance. A connection waits for
+///        input while it reads orders, and for output while its send buffer is not empty.
+/// @param c connection
+/// @param op EPOLL_CTL_ADD or EPOLL_CTL_MOD
+void conn_watch(Connection *c, int op)
+{
+  struct epoll_event ev = { .data.ptr = c, .events = 0 };
+
+  if (c->outpos < c->outlen) ev.events |= EPOLLOUT;
+  if ((c->state == CS_ORDER) && !c->eof) ev.events |= EPOLLIN;
+
+  epoll_ctl(c->loop->epfd, op, c->fd, &ev);
+}
+
+/// @brief release connection @a c
+/// @param c connection
+void conn_free(Connection *c)
+{
+  nc_free(&c->nc);
+  free(c->out);
+  free(c);
+}
+
+/// @brief close connection @a c. A connection with orders in the kitchen is only detached from
+///        its socket; the loop frees it once the last order comes back.
+/// @param c connection
+void conn_close(Connection *c)
+{
+  epoll_ctl(c->loop->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  depart();
+
+  if (c->outstanding > 0) c->closed = true;
+  else conn_free(c);
+}
+
+/// @brief append the @a iovcnt pieces of @a iov to the send buffer of @a c. Grows the buffer if
+///        necessary.
+/// @param c connection
+/// @param iov pieces of the reply
+/// @param iovcnt number of pieces in @a iov
+/// @retval 0 on success
+/// @retval -1 if out of memory
+int conn_write(Connection *c, const struct iovec *iov, int iovcnt)
+{
+  size_t len = 0;
+  int i;
+
+  for (i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+
+  // drop data that has already been sent
+  if (c->outpos == c->outlen) c->outpos = c->outlen = 0;
+
+  while (c->outcap - c->outlen < len) {
+    if (c->outpos > 0) {
+      memmove(c->out, c->out + c->outpos, c->outlen - c->outpos);
+      c->outlen -= c->outpos;
+      c->outpos = 0;
+    } else {
+      char *out = realloc(c->out, 2*c->outcap);
+      if (out == NULL) return -1;
+      c->out = out;
+      c->outcap *= 2;
+    }
+  }
+
+  for (i = 0; i < iovcnt; i++) {
+    memcpy(c->out + c->outlen, iov[i].iov_base, iov[i].iov_len);
+    c->outlen += iov[i].iov_len;
+  }
+
+  return 0;
+}
+
+/// @brief send as much of the send buffer of @a c as the socket takes
+/// @param c connection
+/// @retval 0 on success (data may remain buffered)
+/// @retval -1 if the connection was closed
+int conn_flush(Connection *c)
+{
+  while (c->outpos < c->outlen) {
+    ssize_t r = send(c->fd, c->out + c->outpos, c->outlen - c->outpos, MSG_NOSIGNAL);
+    if (r > 0) {
+      c->outpos += r;
+    } else if ((r < 0) && (errno == EINTR)) {
+      continue;
+    } else if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      break;
+    } else {
+      conn_close(c);
+      return -1;
+    }
+  }
+
+  // the goodbye message, or the reply to the last pipelined order, is out: we're done with
+  // this customer
+  if ((c->outpos == c->outlen) &&
+      ((c->state == CS_GOODBYE) || (c->eof && (c->outstanding == 0)))) {
+    conn_close(c);
+    return -1;
+  }
+
+  return 0;
+}
+
+/// @brief completion callback of orders issued by an event loop. Called by kitchen threads.
+/// @param order finished order
+void conn_order_ready(Node *order)
+{
+  Connection *c = order->arg;
+  EventLoop *loop = c->loop;
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&loop->lock);
+  order->next = loop->ready;
+  loop->ready = order;
+  pthread_mutex_unlock(&loop->lock);
+
+  if (write(loop->evfd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+}
+
+/// @brief accept all pending connections on the listening socket of @a loop and send welcome
+/// @param loop event loop
+void loop_accept(EventLoop *loop)
+{
+  long retry;
+  int fd;
+
+  while ((fd = accept4(loop->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    if ((retry = admit()) > 0) {
+      reject(fd, retry);
+      continue;
+    }
+
+    Connection *c = calloc(1, sizeof(Connection));
+    if ((c == NULL) || ((c->out = malloc(BUF_SIZE)) == NULL) ||
+        (nc_init(&c->nc, fd, BUF_SIZE, BUF_SIZE) < 0)) {
+      if (c != NULL) free(c->out);
+      free(c);
+      close(fd);
+      depart();
+      continue;
+    }
+
+    c->fd = fd;
+    c->state = CS_ORDER;
+    c->loop = loop;
+    c->outcap = BUF_SIZE;
+
+    c->customerID = __atomic_fetch_add(&server_ctx.total_customers, 1, __ATOMIC_RELAXED);
+
+    printf("Customer #%d visited\n", c->customerID);
+    c->outlen = fmt_welcome(c->out, c->customerID);
+
+    conn_watch(c, EPOLL_CTL_ADD);
+    if (conn_flush(c) == 0) conn_watch(c, EPOLL_CTL_MOD);
+  }
+
+  if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) perror("accept4");
+}
+
+/// @brief handle one order line of connection @a c. A tagged first line ("#<id> <burger>")
+///        switches the connection to the keep-alive protocol; otherwise, the line is the one and
+///        only order of the connection.
+/// @param c connection
+/// @param line order line, not '\0'-terminated
+/// @param len length of @a line
+/// @retval 0 on success
+/// @retval -1 if the connection was closed
+int conn_order(Connection *c, const char *line, int len)
+{
+  unsigned long tag = NO_TAG;
+  enum burger_type type;
+
+  // one-shot connections leave CS_ORDER after their first line
+  if (!c->pipelined) c->pipelined = (line[0] == '#');
+
+  // one-shot order: if the burger is not available, close
+  if (!c->pipelined) {
+    if ((type = parse_order(line, len)) == BURGER_TYPE_MAX) {
+      printf("Error: there's no such burger\n");
+      conn_close(c);
+      return -1;
+    }
+    if (issue_order(c->customerID, type, conn_order_ready, c, 0) == NULL) {
+      printf("Error: cannot enqueue the order.\n");
+      conn_close(c);
+      return -1;
+    }
+    c->outstanding++;
+    c->state = CS_COOKING;
+    return 0;
+  }
+
+  // pipelined order: errors are reported to the customer, the connection stays open
+  const char *err = NULL;
+  if (line[0] != '#') {
+    err = ERR_MALFORMED;
+  } else if ((type = parse_tagged_order(line, len, &tag)) == BURGER_TYPE_MAX) {
+    err = (tag == NO_TAG) ? ERR_MALFORMED : ERR_NO_BURGER;
+  } else if (issue_order(c->customerID, type, conn_order_ready, c, tag) == NULL) {
+    err = ERR_ENQUEUE;
+  } else {
+    c->outstanding++;
+  }
+
+  if (err != NULL) {
+    char tagbuf[24];
+    struct iovec iov[2];
+    fmt_error(iov, tagbuf, tag, err);
+    if (conn_write(c, iov, 2) < 0) {
+      conn_close(c);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/// @brief read from connection @a c and issue its orders as soon as the order lines are complete
+/// @param c connection
+void conn_read(Connection *c)
+{
+  const char *line;
+  int len;
+
+  while (1) {
+    // handle all buffered order lines
+    while ((c->state == CS_ORDER) && ((len = nc_next_span(&c->nc, &line)) > 0)) {
+      if (conn_order(c, line, len) < 0) return;
+    }
+    if (c->state != CS_ORDER) break;
+
+    // receive more. Lines longer than BUF_SIZE are not orders (nc_fill() fails with EMSGSIZE)
+    int r = nc_fill(&c->nc);
+    if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) break;
+    if ((r == 0) && c->pipelined) {
+      // the customer is done ordering; close once all replies are out
+      c->eof = true;
+      break;
+    }
+    if (r <= 0) {
+      conn_close(c);
+      return;
+    }
+  }
+
+  if (conn_flush(c) == 0) conn_watch(c, EPOLL_CTL_MOD);
+}
+
+/// @brief hand out all finished orders of @a loop
+/// @param loop event loop
+void loop_complete(EventLoop *loop)
+{
+  uint64_t cnt;
+  Node *order;
+
+  if (read(loop->evfd, &cnt, sizeof(cnt)) < 0) return;
+
+  pthread_mutex_lock(&loop->lock);
+  order = loop->ready;
+  loop->ready = NULL;
+  pthread_mutex_unlock(&loop->lock);
+
+  while (order != NULL) {
+    Node *next = order->next;
+    Connection *c = order->arg;
+    enum burger_type type = order->type;
+    unsigned long tag = order->tag;
+    int r;
+
+    pool_put(&server_ctx.pool, order);
+    c->outstanding--;
+
+    if (c->closed) {
+      if (c->outstanding == 0) conn_free(c);
+    } else {
+      if (c->pipelined) {
+        char tagbuf[24];
+        struct iovec iov[2] = {
+          { .iov_base = tagbuf, .iov_len = fmt_tag(tagbuf, tag) },
+          { .iov_base = reply_ready[type].text, .iov_len = reply_ready[type].len },
+        };
+        r = conn_write(c, iov, 2);
+      } else {
+        struct iovec iov = {
+          .iov_base = reply_goodbye[type].text, .iov_len = reply_goodbye[type].len
+        };
+        c->state = CS_GOODBYE;
+        r = conn_write(c, &iov, 1);
+      }
+      if (r < 0) conn_close(c);
+      else if (conn_flush(c) == 0) conn_watch(c, EPOLL_CTL_MOD);
+    }
+
+    order = next;
+  }
+}
+
+/// @brief event loop thread. Multiplexes the listening socket, client sockets, and the kitchen
+///        eventfd of one loop.
+/// @param arg EventLoop
+void* event_loop(void *arg)
+{
+  EventLoop *loop = arg;
+  struct epoll_event ev[MAX_EVENTS];
+
+  while (1) {
+    bool complete = false;
+    int n = epoll_wait(loop->epfd, ev, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      if (ev[i].data.ptr == &loop->listenfd) {
+        loop_accept(loop);
+      } else if (ev[i].data.ptr == &loop->evfd) {
+        complete = true;
+      } else {
+        Connection *c = ev[i].data.ptr;
+        if (ev[i].events & (EPOLLERR | EPOLLHUP)) {
+          conn_close(c);
+          continue;
+        }
+        if ((ev[i].events & EPOLLOUT) && (conn_flush(c) < 0)) continue;
+        if (ev[i].events & EPOLLIN) conn_read(c);
+        else conn_watch(c, EPOLL_CTL_MOD);
+      }
+    }
+
+    // finished orders last: completing them may free connections that still have events in ev[]
+    if (complete) loop_complete(loop);
+  }
+
+  return NULL;
+}
+
+/// @brief start the event-driven front end: @a num_loops I/O threads, each with its own
+///        listening socket and epoll instance. The kernel distributes connections among them.
+void start_event_server(void)
+{
+  if (num_loops <= 0) num_loops = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_loops <= 0) num_loops = 1;
+
+  EventLoop *loops = calloc(num_loops, sizeof(EventLoop));
+  if (loops == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < num_loops; i++) {
+    EventLoop *loop = &loops[i];
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    loop->listenfd = create_listener(PORT, 1);
+    fcntl(loop->listenfd, F_SETFL, O_NONBLOCK);
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((loop->epfd == -1) || (loop->evfd == -1)) {
+      perror("epoll_create1/eventfd");
+      exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&loop->lock, NULL);
+
+    ev.data.ptr = &loop->listenfd;
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listenfd, &ev);
+    ev.data.ptr = &loop->evfd;
+    epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->evfd, &ev);
+  }
+  listenfd = loops[0].listenfd;
+  printf("Listening... (%d event loop(s))\n", num_loops);
+
+  for (int i = 1; i < num_loops; i++) {
+    pthread_create(&loops[i].tid, NULL, event_loop, &loops[i]);
+  }
+  event_loop(&loops[0]);
+}
+
+/// @brief start server listening
+void start_server()
+{
+  int clientfd, addrlen;
+  struct sockaddr_in client;
+  pthread_t tid;
+  long retry;
+
+  listenfd = create_listener(PORT, 0);
   printf("Listening...\n");
 
   // Keep listening and accepting clients
@@ -396,23 +1480,157 @@ void start_server()
 		printf("accept error\n");
 		exit(-1);
   	}
-	sbuf_insert(&sbuf, clientfd);
-	pthread_t tid;
-	pthread_create(&tid, NULL, serve_client, (void*)&clientfd);
+	// turn customers away before a thread is spent on them
+	if ((retry = admit()) > 0) {
+	  reject(clientfd, retry);
+	  continue;
+	}
+	if (pthread_create(&tid, NULL, serve_client, (void*)(intptr_t)clientfd)) {
+	  close(clientfd);
+	  depart();
+	}
    }
   close(listenfd);
 
 }
 
+/// @brief format the live statistics in the Prometheus text exposition format
+/// @param buf output buffer
+/// @param size size of @a buf
+/// @param rate1 orders served per second during the last second
+/// @param rate10 orders served per second during the last ten seconds
+/// @retval length of the output (truncated to size-1)
+int stats_format(char *buf, size_t size, double rate1, double rate10)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  struct timespec now;
+  double capacity;
+  size_t len = 0;
+  Stats s;
+  int i;
+
+  stats_collect(&s);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  __atomic_load(&server_ctx.kitchen_rate, &capacity, __ATOMIC_RELAXED);
+
+#define OUT(...) \
+  do { if (len < size) len += snprintf(buf + len, size - len, __VA_ARGS__); } while (0)
+
+  OUT("mcdonalds_uptime_seconds %.3f\n", elapsed_ns(&server_ctx.started, &now) / 1e9);
+  OUT("mcdonalds_customers_total %u\n",
+      __atomic_load_n(&server_ctx.total_customers, __ATOMIC_RELAXED));
+  OUT("mcdonalds_customers_in_service %u\n",
+      __atomic_load_n(&server_ctx.total_queueing, __ATOMIC_RELAXED));
+  OUT("mcdonalds_customers_rejected_total %lu\n", s.rejected);
+  OUT("mcdonalds_queue_depth %u\n", order_left());
+  OUT("mcdonalds_orders_served_total %lu\n", s.served);
+  OUT("mcdonalds_orders_per_second{window=\"1s\"} %.3f\n", rate1);
+  OUT("mcdonalds_orders_per_second{window=\"10s\"} %.3f\n", rate10);
+  for (i = 0; i < BURGER_TYPE_MAX; i++) {
+    OUT("mcdonalds_burgers_total{type=\"%s\"} %lu\n", burger_names[i], s.burgers[i]);
+  }
+  OUT("mcdonalds_kitchen_passes_total %lu\n", s.batches);
+  OUT("mcdonalds_kitchen_capacity_per_second %.3f\n", capacity);
+  for (i = 0; i < (int)(sizeof(quantiles)/sizeof(quantiles[0])); i++) {
+    OUT("mcdonalds_service_time_ms{quantile=\"%g\"} %.3f\n", quantiles[i],
+        stats_quantile(&s, quantiles[i]));
+  }
+  OUT("mcdonalds_service_time_ms_sum %.3f\n", s.service_sum / 1e3);
+  OUT("mcdonalds_service_time_ms_count %lu\n", s.served);
+
+#undef OUT
+
+  return len < size ? len : size - 1;
+}
+
+/// @brief statistics thread. Serves the statistics on stats_port to whoever connects (e.g.,
+///        curl or a Prometheus scraper) and samples the number of served orders every second
+///        for the throughput. Runs off the hot path: it only reads the shards.
+/// @param arg unused
+void* stats_task(void *arg)
+{
+  struct { struct timespec t; unsigned long served; } sample[STATS_SAMPLES];
+  unsigned int nsamples = 0;
+  char buf[4096];
+  int fd = create_listener(stats_port, 0);
+
+  printf("Statistics on port %d\n", stats_port);
+
+  while (1) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct timespec now;
+    int ready = poll(&pfd, 1, 1000);
+
+    // 1. sample the number of served orders once per second
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((nsamples == 0) ||
+        (elapsed_ns(&sample[(nsamples - 1) % STATS_SAMPLES].t, &now) >= 1000000000UL)) {
+      Stats s;
+      stats_collect(&s);
+      sample[nsamples % STATS_SAMPLES].t = now;
+      sample[nsamples % STATS_SAMPLES].served = s.served;
+      nsamples++;
+    }
+    if (ready <= 0) continue;
+
+    // 2. serve a request. The request (if any) is drained so that closing the socket does
+    //    not reset the connection before the client has read the reply
+    int clientfd = accept(fd, NULL, NULL);
+    if (clientfd < 0) continue;
+
+    struct pollfd cfd = { .fd = clientfd, .events = POLLIN };
+    if (poll(&cfd, 1, 100) > 0) recv(clientfd, buf, sizeof(buf), MSG_DONTWAIT);
+
+    double rate1 = 0.0, rate10 = 0.0;
+    if (nsamples > 1) {
+      unsigned int last = (nsamples - 1) % STATS_SAMPLES, prev = (nsamples - 2) % STATS_SAMPLES;
+      unsigned int first = nsamples > STATS_SAMPLES ? nsamples % STATS_SAMPLES : 0;
+      rate1 = (sample[last].served - sample[prev].served) * 1e9 /
+              elapsed_ns(&sample[prev].t, &sample[last].t);
+      rate10 = (sample[last].served - sample[first].served) * 1e9 /
+               elapsed_ns(&sample[first].t, &sample[last].t);
+    }
+
+    const char *hdr = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n";
+    int len = stats_format(buf, sizeof(buf), rate1, rate10);
+    put_data(clientfd, (char*)hdr, strlen(hdr));
+    put_data(clientfd, buf, len);
+    shutdown(clientfd, SHUT_WR);
+    close(clientfd);
+  }
+
+  return NULL;
+}
+
 /// @brief prints overall statistics
 void print_statistics(void)
 {
+  OrderQueue *q = &server_ctx.queue;
+  Stats s;
   int i;
 
+  stats_collect(&s);
+
   printf("\n====== Statistics ======\n");
   printf("Number of customers visited: %u\n", server_ctx.total_customers);
+  printf("Number of customers turned away: %lu\n", s.rejected);
   for (i = 0; i < BURGER_TYPE_MAX; i++) {
-    printf("Number of %s burger made: %u\n", burger_names[i], server_ctx.total_burgers[i]);
+    printf("Number of %s burger made: %lu\n", burger_names[i], s.burgers[i]);
+  }
+  if (s.batches > 0) {
+    printf("Kitchen: %lu pass(es), %.2f burger(s) per pass\n", s.batches,
+           (double)s.served / s.batches);
+    printf("Service time [ms]: p50 %.1f, p90 %.1f, p99 %.1f, mean %.1f\n",
+           stats_quantile(&s, 0.5), stats_quantile(&s, 0.9), stats_quantile(&s, 0.99),
+           s.service_sum / 1e3 / s.served);
+  }
+  printf("Order pool: %u node(s), %u in use\n", server_ctx.pool.nodes, server_ctx.pool.in_use);
+  printf("Order queue: %lu enqueued, %lu dequeued, %lu/%lu waits (full/empty)\n",
+         q->enqueued, q->dequeued, q->full_waits, q->empty_waits);
+  if (q->dequeued > 0) {
+    printf("Order queue: enqueue %lu ns, dequeue %lu ns, queueing delay %.3f ms (average)\n",
+           q->enqueue_ns / q->enqueued, q->dequeue_ns / q->dequeued,
+           q->delay_ns / 1e6 / q->dequeued);
   }
   printf("\n");
 }
@@ -478,11 +1696,19 @@ void init_mcdonalds(void)
   printf("\n\n                          I'm lovin it! McDonald's\n\n");
 
   signal(SIGINT, sigint_handler);
+  signal(SIGPIPE, SIG_IGN);
 
   server_ctx.total_customers = 0;
   server_ctx.total_queueing = 0;
-  for (i = 0; i < BURGER_TYPE_MAX; i++) {
-    server_ctx.total_burgers[i] = 0;
+  server_ctx.kitchen_rate = (double)NUM_KITCHEN / COOK_TIME;
+  clock_gettime(CLOCK_MONOTONIC, &server_ctx.started);
+  memset(server_ctx.shard, 0, sizeof(server_ctx.shard));
+  init_replies();
+
+  pool_init(&server_ctx.pool);
+  if (queue_init(&server_ctx.queue, ORDER_QUEUE_SIZE) < 0) {
+    perror("queue_init");
+    exit(EXIT_FAILURE);
   }
 
   //create working threads
@@ -490,16 +1716,60 @@ void init_mcdonalds(void)
 	pthread_create(&kitchen_thread[i], NULL, kitchen_task,NULL);
   }
 
-  //make empty sbuffer
-  sbuf_init(&sbuf, CUSTOMER_MAX);
-  pthread_mutex_init(&mutex, NULL);
+  if (stats_port > 0) {
+    pthread_t tid;
+    pthread_create(&tid, NULL, stats_task, NULL);
+    pthread_detach(tid);
+  }
+}
+
+/// @brief print usage and exit
+/// @param prog program name
+void usage(const char *prog)
+{
+  printf("usage: %s [-e] [-t <loops>] [-b <size>] [-w <ms>] [-l <backlog>] [-c <max>] [-q <ms>]\n"
+         "          [-S <port>]\n"
+         "  -e          event-driven front end (epoll) instead of one thread per customer\n"
+         "  -t <loops>  number of event loops (default: number of cores)\n"
+         "  -b <size>   cook up to <size> orders of the same burger in one pass (default: 1,\n"
+         "              max: %d)\n"
+         "  -w <ms>     wait up to <ms> milliseconds for a batch to fill up (default: 0)\n"
+         "  -l <n>      listen() backlog (default: %d)\n"
+         "  -c <max>    serve at most <max> customers at a time, 0: no limit (default: %d, with\n"
+         "              -e: 0)\n"
+         "  -q <ms>     turn customers away if the queued orders take longer than <ms>\n"
+         "              milliseconds at the measured kitchen capacity (default: 0, off)\n"
+         "  -S <port>   serve live statistics on <port> (default: off)\n",
+         prog, MAX_BATCH, LISTEN_BACKLOG, CUSTOMER_MAX);
+  exit(EXIT_FAILURE);
 }
 
 /// @brief program entry point
 int main(int argc, char *argv[])
 {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "et:b:w:l:c:q:S:h")) != -1) {
+    switch (opt) {
+      case 'e': event_mode = true; break;
+      case 't': num_loops = atoi(optarg); break;
+      case 'b': batch_size = atoi(optarg); break;
+      case 'w': batch_wait_ms = atoi(optarg); break;
+      case 'l': listen_backlog = atoi(optarg); break;
+      case 'c': max_customers = atoi(optarg); break;
+      case 'q': max_delay_ms = atoi(optarg); break;
+      case 'S': stats_port = atoi(optarg); break;
+      default:  usage(argv[0]);
+    }
+  }
+  if ((batch_size < 1) || (batch_size > MAX_BATCH) || (batch_wait_ms < 0) ||
+      (listen_backlog < 1) || (max_customers < -1) || (max_delay_ms < 0) ||
+      (stats_port < 0) || (stats_port > 65535)) usage(argv[0]);
+  if (max_customers == -1) max_customers = event_mode ? 0 : CUSTOMER_MAX;
+
   init_mcdonalds();
-  start_server();
+  if (event_mode) start_event_server();
+  else start_server();
   exit_mcdonalds();
 
   return 0;
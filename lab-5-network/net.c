@@ -9,6 +9,8 @@
 /// 2016/10/14 Bernhard Egger created
 /// 2017/11/24 Bernhard Egger added put/get_line functions
 /// 2017/12/06 Bernhard Egger added getsocklist() & cleanup
+/// 2021/12/14 Park YeongSeo buffered line reader (NetConn), vectored writes
+/// 2021/12/17 Park YeongSeo non-modifying line access (nc_next_span, nc_get_span)
 ///
 /// @section license_section License
 /// Copyright (c) 2016-2021, Computer Systems and Platforms Laboratory, SNU
@@ -42,6 +44,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "net.h"
 
@@ -141,33 +144,81 @@ int put_data(int sock, char *buf, size_t len)
   return transfer_data(NET_SEND, sock, buf, len);
 }
 
+int put_datav(int sock, struct iovec *iov, int iovcnt)
+{
+  if ((iov == NULL) || (iovcnt <= 0)) return -2;
+
+  struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+  int res = 0;
+
+  while (msg.msg_iovlen > 0) {
+    ssize_t r = sendmsg(sock, &msg, 0);
+
+    if (r > 0) {
+      // success: skip the r bytes sent in the buffers
+      res += r;
+      while ((msg.msg_iovlen > 0) && ((size_t)r >= msg.msg_iov->iov_len)) {
+        r -= msg.msg_iov->iov_len;
+        msg.msg_iov++;
+        msg.msg_iovlen--;
+      }
+      if (msg.msg_iovlen > 0) {
+        msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + r;
+        msg.msg_iov->iov_len -= r;
+      }
+    } else if (r == 0) {
+      break;
+    } else {
+      if (errno == EINTR) continue;
+      res = -1;
+      break;
+    }
+  }
+
+  return res;
+}
+
 int get_line(int sock, char **buf, size_t *cur_len)
 {
   if (*cur_len == 0) return -2;
 
-  char c;
   int res = 0;
   size_t pos = 0;
+  char *nl = NULL;
 
-  // read to first newline ('\n') or transmission error
-  do {
-    res = get_data(sock, &c, 1);
-    if (res == 1) {
-      (*buf)[pos++] = c;
-
-      // allocate more memory for buf if necessary
-      if (pos == *cur_len) {
-        *cur_len <<= 1;
-        *buf = (char *)realloc(*buf, *cur_len);
-      }
+  // read to first newline ('\n') or transmission error. We must not consume data beyond the
+  // newline, so we peek at what's available and then receive exactly up to the newline.
+  while (nl == NULL) {
+    // allocate more memory for buf if necessary
+    if (pos + 1 >= *cur_len) {
+      *cur_len <<= 1;
+      *buf = (char *)realloc(*buf, *cur_len);
+    }
+
+    int r = recv(sock, *buf + pos, *cur_len - 1 - pos, MSG_PEEK);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      res = -1;
+      break;
+    }
+    if (r == 0) {
+      res = 0;
+      break;
     }
-  } while ((res == 1) && (c != '\n'));
+
+    nl = memchr(*buf + pos, '\n', r);
+    if (nl != NULL) r = nl - (*buf + pos) + 1;
+
+    res = get_data(sock, *buf + pos, r);
+    if (res <= 0) break;
+    pos += res;
+  }
 
   // null-terminate string
   (*buf)[pos] = '\0';
 
   // return number of characters read (excluding \0) or error
-  if (c == '\n') return (int)pos; // we assume pos < MAX_INT
+  if (nl != NULL) return (int)pos; // we assume pos < MAX_INT
   else return res;
 }
 
@@ -175,27 +226,128 @@ int put_line(int sock, char *buf, size_t len)
 {
   if (len == 0) return -2;
 
-  char c;
-  int res = 1, res2;
   size_t pos = 0;
+  struct iovec iov[2];
+  int iovcnt = 0;
 
   // find end of string (terminating '\0')
   while ((pos < len) && (buf[pos] != '\0')) pos++;
 
-  // there was some data (not just a '\0'), send it (exclude terminating '\0')
-  if (pos > 0) {
-    res = put_data(sock, buf, pos);
+  // send the data (exclude terminating '\0') and a '\n' if the string isn't ended by it, in one
+  // system call so that the newline rides in the same segment
+  if (pos > 0) iov[iovcnt++] = (struct iovec){ .iov_base = buf, .iov_len = pos };
+  if ((pos == 0) || (buf[pos-1] != '\n')) {
+    iov[iovcnt++] = (struct iovec){ .iov_base = "\n", .iov_len = 1 };
+  }
+
+  // return number of bytes sent, <0 on error
+  return put_datav(sock, iov, iovcnt);
+}
+
+int nc_init(NetConn *nc, int sock, size_t size, size_t max)
+{
+  if (size < 2) size = 2;
+
+  nc->sock = sock;
+  nc->buf = malloc(size);
+  nc->size = size;
+  nc->max = max;
+  nc->start = nc->end = nc->scan = 0;
+
+  return nc->buf != NULL ? 0 : -1;
+}
+
+void nc_free(NetConn *nc)
+{
+  free(nc->buf);
+  nc->buf = NULL;
+  nc->size = nc->start = nc->end = nc->scan = 0;
+}
+
+int nc_fill(NetConn *nc)
+{
+  // make room: move unconsumed data to the front, grow the buffer if it is full. One byte is
+  // reserved so that the line can always be '\0'-terminated. A buffer that has reached the
+  // maximum line length without containing a newline is not grown.
+  if (nc->start > 0) {
+    memmove(nc->buf, nc->buf + nc->start, nc->end - nc->start);
+    nc->end -= nc->start;
+    nc->start = 0;
   }
+  if (nc->end + 1 >= nc->size) {
+    size_t size = nc->size * 2;
+    if ((nc->max > 0) && (size > nc->max + 1)) size = nc->max + 1;
+    if (size <= nc->size) {
+      errno = EMSGSIZE;
+      return -1;
+    }
 
-  // send '\n' if string wasn't ended by it
-  if ((res > 0) && (buf[pos-1] != '\n')) {
-    c = '\n';
-    res2 = put_data(sock, &c, 1);
-    if (res2 < 0) res = res2;
-    else res += res2;
+    char *b = realloc(nc->buf, size);
+    if (b == NULL) return -1;
+    nc->buf = b;
+    nc->size = size;
+  }
+
+  int r;
+  do {
+    r = recv(nc->sock, nc->buf + nc->end, nc->size - 1 - nc->end, 0);
+  } while ((r < 0) && (errno == EINTR));
+
+  if (r > 0) nc->end += r;
+  return r;
+}
+
+int nc_next_span(NetConn *nc, const char **line)
+{
+  char *s = nc->buf + nc->start;
+  char *nl = memchr(s + nc->scan, '\n', nc->end - nc->start - nc->scan);
+
+  if (nl == NULL) {
+    // remember what we've scanned so that we don't scan it again
+    nc->scan = nc->end - nc->start;
+    return 0;
+  }
+
+  int len = nl - s + 1;
+  nc->start += len;
+  nc->scan = 0;
+  *line = s;
+
+  return len;
+}
+
+int nc_next_line(NetConn *nc, char **line)
+{
+  int len = nc_next_span(nc, (const char**)line);
+
+  if (len > 0) (*line)[len-1] = '\0';
+
+  return len;
+}
+
+int nc_get_line(NetConn *nc, char **line)
+{
+  if ((nc == NULL) || (nc->buf == NULL) || (line == NULL)) return -2;
+
+  int res;
+  while ((res = nc_next_line(nc, line)) == 0) {
+    res = nc_fill(nc);
+    if (res <= 0) return res;
   }
 
-  // return  0 for success, <0 on error
   return res;
 }
 
+
+int nc_get_span(NetConn *nc, const char **line)
+{
+  if ((nc == NULL) || (nc->buf == NULL) || (line == NULL)) return -2;
+
+  int res;
+  while ((res = nc_next_span(nc, line)) == 0) {
+    res = nc_fill(nc);
+    if (res <= 0) return res;
+  }
+
+  return res;
+}
@@ -10,6 +10,8 @@
 /// 2017/11/24 Bernhard Egger added put/get_line functions
 /// 2017/12/06 Bernhard Egger added getsocklist() & cleanup
 /// 2020/11/25 Bernhard Egger cleanup & minor bugfixes
+/// 2021/12/14 Park YeongSeo buffered line reader (NetConn), vectored writes
+/// 2021/12/17 Park YeongSeo non-modifying line access (nc_next_span, nc_get_span)
 ///
 /// @section license_section License
 /// Copyright (c) 2016-2021, Computer Systems and Platforms Laboratory, SNU
@@ -38,6 +40,7 @@
 #ifndef __NET_H__
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 /// @name network helper functions
 /// @{
@@ -86,6 +89,18 @@ int get_data(int sock, char *buf, size_t len);
 /// @retval -2 invalid arguments
 int put_data(int sock, char *buf, size_t len);
 
+/// @brief write the @a iovcnt buffers of @a iov to @a sock with as few system calls as possible.
+///        Blocks until all data has been written, and survives interrupts caused by signals.
+///        @a iov is modified.
+/// @param sock socket to write to
+/// @param iov array of buffers
+/// @param iovcnt number of buffers in @a iov
+/// @retval >0 number of bytes sent
+/// @retval == 0 nothing sent (socket closed by peer)
+/// @retval -1 error, errno contains error code
+/// @retval -2 invalid arguments
+int put_datav(int sock, struct iovec *iov, int iovcnt);
+
 /// @}
 
 /// @name sending/receiving of '\n'-terminated strings
@@ -116,5 +131,83 @@ int put_line(int sock, char *buf, size_t len);
 
 /// @}
 
+/// @name buffered reading of '\n'-terminated strings
+/// @{
+
+/// @brief buffered connection. Data is received in large chunks; complete lines are handed out
+///        directly from the buffer, so one recv() may yield several (pipelined) lines.
+///        Unconsumed data is moved to the front of the buffer before the next receive.
+typedef struct {
+  int sock;                       ///< socket
+  char *buf;                      ///< receive buffer
+  size_t size;                    ///< size of buf
+  size_t max;                     ///< maximum line length (0: unlimited)
+  size_t start;                   ///< first unconsumed byte in buf
+  size_t end;                     ///< end of received data in buf
+  size_t scan;                    ///< bytes from start known not to contain a newline
+} NetConn;
+
+/// @brief initialize buffered connection @a nc on @a sock
+/// @param nc buffered connection
+/// @param sock socket (blocking or non-blocking)
+/// @param size initial buffer size. The buffer grows for longer lines.
+/// @param max maximum line length, including the newline. The buffer does not grow beyond it,
+///        so a peer that never sends a newline cannot exhaust the memory. 0: unlimited.
+/// @retval 0 on success
+/// @retval -1 if the buffer cannot be allocated
+int nc_init(NetConn *nc, int sock, size_t size, size_t max);
+
+/// @brief release the buffer of @a nc. Does not close the socket.
+/// @param nc buffered connection
+void nc_free(NetConn *nc);
+
+/// @brief receive data into the buffer of @a nc with a single recv(). Survives interrupts.
+/// @param nc buffered connection
+/// @retval >0 number of bytes received
+/// @retval == 0 nothing read (socket closed by peer)
+/// @retval -1 error, errno contains error code (EAGAIN/EWOULDBLOCK on non-blocking sockets,
+///         EMSGSIZE if the buffered data holds no newline within the maximum line length)
+int nc_fill(NetConn *nc);
+
+/// @brief get the next complete line from the buffer of @a nc without receiving. The line is
+///        '\0'-terminated in place (replacing the newline) and remains valid until the next
+///        call to nc_fill() or nc_get_line().
+/// @param nc buffered connection
+/// @param line pointer to line. Out parameter.
+/// @retval >0 length of line (including terminating newline)
+/// @retval == 0 no complete line buffered
+int nc_next_line(NetConn *nc, char **line);
+
+/// @brief read a '\n'-terminated line from @a nc. Blocks until a line has been read (on
+///        blocking sockets), and survives interrupts caused by signals. See nc_next_line().
+/// @param nc buffered connection
+/// @param line pointer to line. Out parameter.
+/// @retval >0 length of line (including terminating newline)
+/// @retval == 0 nothing read (socket closed by peer)
+/// @retval -1 error, errno contains error code (EMSGSIZE if the line is too long)
+/// @retval -2 invalid arguments
+int nc_get_line(NetConn *nc, char **line);
+
+/// @brief get the next complete line from the buffer of @a nc without receiving. Unlike
+///        nc_next_line(), the buffer is not modified: the line is not '\0'-terminated. It
+///        remains valid until the next call to nc_fill() or nc_get_span().
+/// @param nc buffered connection
+/// @param line pointer to line. Out parameter.
+/// @retval >0 length of line (including terminating newline)
+/// @retval == 0 no complete line buffered
+int nc_next_span(NetConn *nc, const char **line);
+
+/// @brief read a '\n'-terminated line from @a nc without modifying it. Blocks until a line has
+///        been read (on blocking sockets). See nc_next_span() and nc_get_line().
+/// @param nc buffered connection
+/// @param line pointer to line. Out parameter.
+/// @retval >0 length of line (including terminating newline)
+/// @retval == 0 nothing read (socket closed by peer)
+/// @retval -1 error, errno contains error code (EMSGSIZE if the line is too long)
+/// @retval -2 invalid arguments
+int nc_get_span(NetConn *nc, const char **line);
+
+/// @}
+
 
 #endif // __NET_H__